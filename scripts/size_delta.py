@@ -0,0 +1,59 @@
+"""
+Compare the flash and RAM use of the firmware between two git revisions.
+Builds env:micro of each revision in a temporary git worktree and prints avr-size of both.
+
+usage: python scripts/size_delta.py <before> [<after>]
+e.g. python scripts/size_delta.py 4f8232f HEAD
+"""
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+ENV = "micro"
+
+
+def find_avr_size():
+    # avr-size from the PlatformIO toolchain, or from PATH
+    toolchain = os.path.join(os.path.expanduser("~"), ".platformio", "packages", "toolchain-atmelavr", "bin", "avr-size")
+    if os.path.exists(toolchain):
+        return toolchain
+    found = shutil.which("avr-size")
+    if found is None:
+        raise Exception("avr-size not found. build env:micro once, so PlatformIO installs the toolchain")
+    return found
+
+
+def build_size(revision):
+    worktree = tempfile.mkdtemp(prefix="size_delta_")
+    try:
+        subprocess.check_call(["git", "worktree", "add", "--detach", worktree, revision], stdout=subprocess.DEVNULL)
+        subprocess.check_call(["pio", "run", "-e", ENV, "-d", worktree], stdout=subprocess.DEVNULL)
+
+        # berkeley format: text data bss dec hex filename
+        elf = os.path.join(worktree, ".pio", "build", ENV, "firmware.elf")
+        output = subprocess.check_output([find_avr_size(), elf], text=True)
+        text, data, bss = (int(v) for v in output.splitlines()[1].split()[:3])
+        return {"flash": text + data, "ram": data + bss}
+    finally:
+        subprocess.call(["git", "worktree", "remove", "--force", worktree])
+
+
+def main():
+    if len(sys.argv) < 2:
+        print(__doc__)
+        sys.exit(1)
+
+    before_revision = sys.argv[1]
+    after_revision = sys.argv[2] if len(sys.argv) > 2 else "HEAD"
+    before = build_size(before_revision)
+    after = build_size(after_revision)
+
+    print(f"{'':8}{before_revision:>12}{after_revision:>12}{'delta':>10}")
+    for key in ("flash", "ram"):
+        print(f"{key:8}{before[key]:>12}{after[key]:>12}{after[key] - before[key]:>+10}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,99 @@
+#pragma once
+#include <Arduino.h>
+
+/**
+ * a single button state change
+ */
+struct button_edge_t
+{
+  uint32_t timestamp; // millis() when the edge was observed
+  uint8_t button;     // index of the button
+  bool pressed;       // true if the button was pressed, false if it was released
+};
+
+/**
+ * single-producer, single-consumer queue of button edges.
+ * used to hand button changes downstream without losing presses that are shorter than the consumer's update interval.
+ *
+ * @tparam SIZE number of slots. must be a power of two, at most 128. holds up to SIZE - 1 edges
+ *
+ * @note
+ * push() must only be called by the producer, pop() and clear() only by the consumer.
+ * the producer never modifies tail and the consumer never modifies head, so no locking is needed.
+ *
+ * @note
+ * when the queue is full, new edges are dropped and counted. see get_overflows()
+ */
+template <uint8_t SIZE>
+class ButtonEdgeQueue
+{
+  static_assert((SIZE & (SIZE - 1)) == 0, "ButtonEdgeQueue SIZE must be a power of two!");
+  static_assert(SIZE >= 2 && SIZE <= 128, "ButtonEdgeQueue SIZE must be in range [2, 128]!");
+
+public:
+  /**
+   * add an edge to the end of the queue
+   * @param edge the edge to add
+   * @return false if the queue is full and the edge was dropped
+   */
+  bool push(const button_edge_t &edge)
+  {
+    const uint8_t next = (head + 1) & (SIZE - 1);
+    if (next == tail)
+    {
+      this->overflows++;
+      return false;
+    }
+
+    this->edges[head] = edge;
+    this->head = next;
+    return true;
+  }
+
+  /**
+   * remove the oldest edge from the queue
+   * @param edge receives the removed edge
+   * @return false if the queue is empty
+   */
+  bool pop(button_edge_t &edge)
+  {
+    if (head == tail)
+    {
+      return false;
+    }
+
+    edge = this->edges[tail];
+    this->tail = (tail + 1) & (SIZE - 1);
+    return true;
+  }
+
+  /**
+   * drop all queued edges
+   */
+  void clear()
+  {
+    this->tail = head;
+  }
+
+  bool empty() const { return head == tail; }
+
+  /**
+   * number of edges dropped because the queue was full
+   */
+  uint16_t get_overflows() const { return overflows; }
+
+private:
+  button_edge_t edges[SIZE];
+
+  /**
+   * write position, only modified by push()
+   */
+  volatile uint8_t head = 0;
+
+  /**
+   * read position, only modified by pop() and clear()
+   */
+  volatile uint8_t tail = 0;
+
+  uint16_t overflows = 0;
+};
@@ -0,0 +1,144 @@
+#pragma once
+#include <Arduino.h>
+
+/**
+ * signed Q15 fixed-point value.
+ * represents the range [-1.0, 1.0], where 1.0 is Q15_MAX
+ */
+typedef int16_t q15_t;
+
+constexpr q15_t Q15_MAX = 32767;  // 1.0
+constexpr q15_t Q15_MIN = -32767; // -1.0. symmetric, so negating never overflows
+
+/**
+ * number of significant bits of a value
+ */
+constexpr uint8_t q15_bit_length(const uint32_t value)
+{
+  return value == 0 ? 0 : 1 + q15_bit_length(value >> 1);
+}
+
+/**
+ * shift of the reciprocal of a bound, see q15_divide()
+ * @param bound the bound, > 0
+ * @param scale Q15 factor the result is multiplied with, > 0
+ * @note chosen so the factor uses at least 15 bits, but never overflows 16 bits
+ */
+constexpr uint8_t q15_reciprocal_shift(const uint16_t bound, const q15_t scale = Q15_MAX)
+{
+  return q15_bit_length(bound) + 15 - q15_bit_length(scale);
+}
+
+/**
+ * factor of the reciprocal of a bound, see q15_divide()
+ * @param bound the bound, > 0
+ * @param scale Q15 factor the result is multiplied with, > 0
+ * @note scale * 2^shift / bound, rounded
+ */
+constexpr uint16_t q15_reciprocal_factor(const uint16_t bound, const q15_t scale = Q15_MAX)
+{
+  return ((static_cast<uint32_t>(scale) << q15_reciprocal_shift(bound, scale)) + (bound / 2)) / bound;
+}
+
+/**
+ * divide a value by a bound, using its precomputed reciprocal
+ * @param value the value to divide
+ * @param factor reciprocal factor of the bound, from q15_reciprocal_factor()
+ * @param shift reciprocal shift of the bound, from q15_reciprocal_shift()
+ * @param invert negate the result
+ * @return value / bound (* scale) in Q15, rounded and saturated to [Q15_MIN, Q15_MAX]
+ * @note the rounded reciprocal keeps the result within one of the exactly rounded quotient, and exact at the bound
+ * @note only needs a 16x16 bit multiplication, no division. with constant arguments, the shift and sign are folded
+ */
+inline q15_t q15_divide(const int16_t value, const uint16_t factor, const uint8_t shift, const bool invert = false)
+{
+  // work on the magnitude, so rounding is symmetric around zero
+  const uint16_t magnitude = value < 0 ? -static_cast<int32_t>(value) : value;
+  const uint32_t product = static_cast<uint32_t>(magnitude) * factor;
+  const uint32_t quotient = (product + (static_cast<uint32_t>(1) << (shift - 1))) >> shift;
+  const q15_t saturated = quotient > static_cast<uint32_t>(Q15_MAX) ? Q15_MAX : static_cast<q15_t>(quotient);
+  return (value < 0) != invert ? -saturated : saturated;
+}
+
+/**
+ * scale a magnitude from [0, bound] to [0, scale], using the precomputed reciprocal of the bound
+ * @param magnitude the magnitude, range 0 to bound
+ * @param bound the bound, > 0
+ * @param scale the upper end of the output range, > 0
+ * @param factor reciprocal factor of the bound, from q15_reciprocal_factor(bound, scale)
+ * @param shift reciprocal shift of the bound, from q15_reciprocal_shift(bound, scale)
+ * @param exact set to true if the quotient has no remainder
+ * @return magnitude * scale / bound, truncated
+ * @note the reciprocal gets within one of the quotient, the remainder corrects that. so the result is exact, using 16x16 bit multiplications only
+ */
+inline uint16_t scale_truncated(const uint16_t magnitude, const uint16_t bound, const q15_t scale, const uint16_t factor, const uint8_t shift, bool &exact)
+{
+  uint16_t quotient = (static_cast<uint32_t>(magnitude) * factor) >> shift;
+  int32_t remainder = static_cast<int32_t>(static_cast<uint32_t>(magnitude) * scale) - static_cast<int32_t>(static_cast<uint32_t>(quotient) * bound);
+  if (remainder < 0)
+  {
+    quotient--;
+    remainder += bound;
+  }
+  else if (remainder >= bound)
+  {
+    quotient++;
+    remainder -= bound;
+  }
+
+  exact = remainder == 0;
+  return quotient;
+}
+
+static_assert(q15_reciprocal_factor(1) == 65534 && q15_reciprocal_shift(1) == 1, "q15 reciprocal of 1 is wrong!");
+static_assert(q15_reciprocal_factor(32768) == 65534 && q15_reciprocal_shift(32768) == 16, "q15 reciprocal of 32768 is wrong!");
+
+/**
+ * multiply a Q15 value by another Q15 value, or by an integer in the same range
+ * @param value the Q15 value
+ * @param factor the factor. a Q15 value, or an integer to scale value to [-factor, factor]
+ * @return value * factor / Q15_MAX, rounded and saturated to [Q15_MIN, Q15_MAX]
+ * @note multiplying by Q15_MAX returns value unchanged
+ */
+inline q15_t q15_multiply(const q15_t value, const int16_t factor)
+{
+  // work on the magnitudes, so rounding is symmetric around zero
+  const uint16_t value_magnitude = value < 0 ? -static_cast<int32_t>(value) : value;
+  const uint16_t factor_magnitude = factor < 0 ? -static_cast<int32_t>(factor) : factor;
+  const uint32_t product = static_cast<uint32_t>(value_magnitude) * factor_magnitude;
+
+  // round(product / Q15_MAX) = floor((product + Q15_MAX / 2) / (2^15 - 1)).
+  // division by 2^15 - 1 is exact using (t + (t >> 15) + 1) >> 15 for t < 2^30, larger products saturate anyway
+  const uint32_t rounded = product + (Q15_MAX / 2);
+  const uint32_t quotient = (rounded + (rounded >> 15) + 1) >> 15;
+  const q15_t saturated = quotient > static_cast<uint32_t>(Q15_MAX) ? Q15_MAX : static_cast<q15_t>(quotient);
+  return (value < 0) != (factor < 0) ? -saturated : saturated;
+}
+
+/**
+ * convert a float to Q15
+ * @param value the value, range -1.0 to 1.0. values outside are saturated
+ * @note pulls in the float library, only for compatibility with float callers
+ */
+inline q15_t q15_from_float(const float value)
+{
+  if (value >= 1.0f)
+  {
+    return Q15_MAX;
+  }
+  if (value <= -1.0f)
+  {
+    return Q15_MIN;
+  }
+
+  return static_cast<q15_t>(value * Q15_MAX + (value < 0.0f ? -0.5f : 0.5f));
+}
+
+/**
+ * convert a Q15 value to float
+ * @note pulls in the float library, only for compatibility with float callers
+ */
+inline float q15_to_float(const q15_t value)
+{
+  return value * (1.0f / Q15_MAX);
+}
@@ -0,0 +1,286 @@
+#pragma once
+#include <Arduino.h>
+#include "../FixedPoint.hpp"
+
+namespace magellan_internal
+{
+  /**
+   * axes of the Magellan, as reported in the position / rotation message
+   */
+  enum axis_t : uint8_t
+  {
+    AXIS_X, // x position
+    AXIS_Y, // y position
+    AXIS_Z, // z position
+    AXIS_U, // rotation around x axis
+    AXIS_V, // rotation around y axis
+    AXIS_W, // rotation around z axis
+    AXIS_COUNT
+  };
+
+  /**
+   * a value for each axis
+   */
+  template <typename T>
+  struct axis_values_t
+  {
+    T x, y, z, u, v, w;
+  };
+
+  /**
+   * get the value of an axis, resolved at compile time
+   */
+  template <axis_t AXIS, typename T>
+  inline T axis_value(const axis_values_t<T> &values)
+  {
+    return AXIS == AXIS_X   ? values.x
+           : AXIS == AXIS_Y ? values.y
+           : AXIS == AXIS_Z ? values.z
+           : AXIS == AXIS_U ? values.u
+           : AXIS == AXIS_V ? values.v
+                            : values.w;
+  }
+
+  /**
+   * output range of the float data path that was replaced by the integer path, [-FLOAT_PATH_RANGE, FLOAT_PATH_RANGE]
+   */
+  constexpr int16_t FLOAT_PATH_RANGE = 800;
+
+  /**
+   * the output counts the float data path gave for the exact value n / range
+   * @param n the exact value, range -range to range
+   * @param range the output range is [-range, range]
+   * @note
+   * the float path normalized to [-1.0, 1.0] and mapped that with range[0] + (value + 1.0f) * span / 2, truncated.
+   * only used at compile time, so the float operations are folded by the compiler
+   */
+  constexpr int16_t float_path_counts(const int16_t n, const int16_t range)
+  {
+    return static_cast<int16_t>(-range + (static_cast<float>(n) / static_cast<float>(range) + 1.0f) * (2 * range) / 2);
+  }
+
+  /**
+   * one byte of the float rounding table of a range, see float_rounding_t
+   * @param index index of the byte
+   * @param range the output range is [-range, range]
+   * @param bit the bit to compute, and all above it
+   */
+  constexpr uint8_t float_rounding_byte(const uint16_t index, const int16_t range, const uint8_t bit = 0)
+  {
+    return bit == 8 ? 0
+                    : ((index * 8 + bit <= 2 * range && float_path_counts(index * 8 + bit - range, range) != index * 8 + bit - range) ? (1 << bit) : 0)
+                          | float_rounding_byte(index, range, bit + 1);
+  }
+
+  /**
+   * list of indices, to expand a table at compile time
+   */
+  template <uint16_t... I>
+  struct index_list_t
+  {
+  };
+
+  template <class A, class B>
+  struct index_list_concat_t;
+
+  template <uint16_t... A, uint16_t... B>
+  struct index_list_concat_t<index_list_t<A...>, index_list_t<B...>>
+  {
+    typedef index_list_t<A..., static_cast<uint16_t>(sizeof...(A) + B)...> type;
+  };
+
+  /**
+   * index_list_t of 0 to N - 1. split in halves, so the template depth stays low for large N
+   */
+  template <uint16_t N>
+  struct make_index_list_t
+  {
+    typedef typename index_list_concat_t<typename make_index_list_t<N / 2>::type, typename make_index_list_t<N - N / 2>::type>::type type;
+  };
+
+  template <>
+  struct make_index_list_t<0>
+  {
+    typedef index_list_t<> type;
+  };
+
+  template <>
+  struct make_index_list_t<1>
+  {
+    typedef index_list_t<0> type;
+  };
+
+  /**
+   * which exact values of a range the float data path gave one count toward zero, from rounding of the float operations.
+   * e.g. -1510 / 3775 is exactly -320 / 800, but the float path gave -319
+   *
+   * @tparam RANGE the output range is [-RANGE, RANGE]
+   * @note
+   * the float rounding of an exact value only depends on n and RANGE, not on the calibration.
+   * at FLOAT_PATH_RANGE, values that are not exact were always truncated correctly. at larger ranges they were not
+   * @note one bit per value, in PROGMEM. RANGE / 4 + 1 bytes
+   */
+  template <int16_t RANGE, class INDICES = typename make_index_list_t<RANGE / 4 + 1>::type>
+  struct float_rounding_t;
+
+  template <int16_t RANGE, uint16_t... I>
+  struct float_rounding_t<RANGE, index_list_t<I...>>
+  {
+    static const uint8_t TABLE[sizeof...(I)] PROGMEM;
+
+    /**
+     * did the float path give the exact value n one count toward zero?
+     * @param n the exact value, range -RANGE to RANGE
+     */
+    static inline bool toward_zero(const int16_t n)
+    {
+      const uint16_t index = n + RANGE;
+      return (pgm_read_byte(&TABLE[index >> 3]) & (1 << (index & 7))) != 0;
+    }
+  };
+
+  template <int16_t RANGE, uint16_t... I>
+  const uint8_t float_rounding_t<RANGE, index_list_t<I...>>::TABLE[sizeof...(I)] PROGMEM = {float_rounding_byte(I, RANGE)...};
+
+  /**
+   * scale a value from [-bound, bound] to output counts, truncated toward zero
+   * @tparam RANGE the output range is [-RANGE, RANGE]
+   * @param value the value. saturated at the bound
+   * @param bound the calibrated bound on the side of the value, > 0
+   * @param factor reciprocal factor of the bound, from q15_reciprocal_factor(bound, RANGE)
+   * @param shift reciprocal shift of the bound, from q15_reciprocal_shift(bound, RANGE)
+   * @param invert negate the result
+   * @return value * RANGE / bound, range -RANGE to RANGE
+   * @note
+   * at FLOAT_PATH_RANGE, this gives the same counts as the float data path for every bound up to 4096, including its rounding.
+   * other ranges had no float path, so they are truncated exactly
+   */
+  template <int16_t RANGE>
+  inline int16_t scale_to_counts(const int16_t value, const uint16_t bound, const uint16_t factor, const uint8_t shift, const bool invert)
+  {
+    static_assert(RANGE > 0, "scale_to_counts RANGE must be positive!");
+
+    const uint16_t magnitude = value < 0 ? -static_cast<int32_t>(value) : value;
+    bool exact;
+    const int16_t quotient = scale_truncated(magnitude < bound ? magnitude : bound, bound, RANGE, factor, shift, exact);
+    int16_t counts = (value < 0) != invert ? -quotient : quotient;
+
+    // exact values are where the float rounding could go below the truncation
+    if (RANGE == FLOAT_PATH_RANGE && exact && float_rounding_t<FLOAT_PATH_RANGE>::toward_zero(counts))
+    {
+      counts += counts < 0 ? 1 : -1;
+    }
+    return counts;
+  }
+
+  /**
+   * turns raw axis values into normalized output values, see axis_pipeline_t
+   */
+  typedef void (*axis_pipeline_fn)(const axis_values_t<int16_t> &raw, axis_values_t<q15_t> &normalized);
+
+  /**
+   * compile-time description of how a single output axis is computed.
+   * the output is source / calibration bound * sign * scale, in Q15.
+   *
+   * @tparam SOURCE the Magellan axis to read
+   * @tparam MIN calibrated minimum of the source axis, < 0
+   * @tparam MAX calibrated maximum of the source axis, > 0
+   * @tparam SIGN 1 to keep the direction, -1 to invert it
+   * @tparam SCALE scale factor in Q15, Q15_MAX for none
+   *
+   * @note
+   * sign and scale are folded into the calibration reciprocals at compile time,
+   * so every axis costs a single multiplication and a constant shift, regardless of the configuration
+   */
+  template <axis_t SOURCE, int16_t MIN, int16_t MAX, int8_t SIGN = 1, q15_t SCALE = Q15_MAX>
+  struct axis_map_t
+  {
+    static_assert(SOURCE < AXIS_COUNT, "axis_map_t SOURCE must be a valid axis!");
+    static_assert(MIN < 0, "axis_map_t MIN must be negative!");
+    static_assert(MAX > 0, "axis_map_t MAX must be positive!");
+    static_assert(SIGN == 1 || SIGN == -1, "axis_map_t SIGN must be 1 or -1!");
+    static_assert(SCALE > 0 && SCALE <= Q15_MAX, "axis_map_t SCALE must be in range [1, Q15_MAX]!");
+
+    static constexpr axis_t source = SOURCE;
+
+    static constexpr uint16_t POSITIVE_FACTOR = q15_reciprocal_factor(MAX, SCALE);
+    static constexpr uint8_t POSITIVE_SHIFT = q15_reciprocal_shift(MAX, SCALE);
+    static constexpr uint16_t NEGATIVE_FACTOR = q15_reciprocal_factor(-static_cast<int32_t>(MIN), SCALE);
+    static constexpr uint8_t NEGATIVE_SHIFT = q15_reciprocal_shift(-static_cast<int32_t>(MIN), SCALE);
+
+    /**
+     * compute the output value
+     * @param raw the raw values
+     * @return the output value, range Q15_MIN to Q15_MAX
+     */
+    static inline q15_t apply(const axis_values_t<int16_t> &raw)
+    {
+      const int16_t value = axis_value<SOURCE>(raw);
+      return value < 0
+                 ? q15_divide(value, NEGATIVE_FACTOR, NEGATIVE_SHIFT, SIGN < 0)
+                 : q15_divide(value, POSITIVE_FACTOR, POSITIVE_SHIFT, SIGN < 0);
+    }
+
+    /**
+     * compute the output value in output counts, straight from the raw value
+     * @tparam RANGE the output range is [-RANGE, RANGE], e.g. the HID range
+     * @param raw the raw values
+     * @return the output value, range -RANGE to RANGE
+     * @note
+     * without a scale, this gives the same counts as the float data path at its range, see scale_to_counts().
+     * the float path had no scale, so scaled axes go through apply() and are rounded to nearest
+     */
+    template <int16_t RANGE>
+    static inline int16_t counts(const axis_values_t<int16_t> &raw)
+    {
+      if (SCALE != Q15_MAX)
+      {
+        return q15_multiply(apply(raw), RANGE);
+      }
+
+      const int16_t value = axis_value<SOURCE>(raw);
+      return value < 0
+                 ? scale_to_counts<RANGE>(value, -static_cast<int32_t>(MIN), q15_reciprocal_factor(-static_cast<int32_t>(MIN), RANGE), q15_reciprocal_shift(-static_cast<int32_t>(MIN), RANGE), SIGN < 0)
+                 : scale_to_counts<RANGE>(value, MAX, q15_reciprocal_factor(MAX, RANGE), q15_reciprocal_shift(MAX, RANGE), SIGN < 0);
+    }
+  };
+
+  /**
+   * compile-time axis pipeline, mapping the Magellan axes to the output axes.
+   * use &axis_pipeline_t<...>::apply as axis_pipeline_fn
+   *
+   * @tparam X, Y, Z, U, V, W axis_map_t for each output axis
+   */
+  template <class X, class Y, class Z, class U, class V, class W>
+  struct axis_pipeline_t
+  {
+    static_assert(((1 << X::source) | (1 << Y::source) | (1 << Z::source) | (1 << U::source) | (1 << V::source) | (1 << W::source)) == ((1 << AXIS_COUNT) - 1),
+                  "axis_pipeline_t must use every Magellan axis exactly once!");
+
+    static void apply(const axis_values_t<int16_t> &raw, axis_values_t<q15_t> &normalized)
+    {
+      normalized.x = X::apply(raw);
+      normalized.y = Y::apply(raw);
+      normalized.z = Z::apply(raw);
+      normalized.u = U::apply(raw);
+      normalized.v = V::apply(raw);
+      normalized.w = W::apply(raw);
+    }
+
+    /**
+     * compute the output values in output counts, straight from the raw values, see axis_map_t::counts()
+     * @tparam TRANSLATION_RANGE range of x, y and z is [-TRANSLATION_RANGE, TRANSLATION_RANGE]
+     * @tparam ROTATION_RANGE range of u, v and w is [-ROTATION_RANGE, ROTATION_RANGE]
+     */
+    template <int16_t TRANSLATION_RANGE, int16_t ROTATION_RANGE>
+    static void counts(const axis_values_t<int16_t> &raw, axis_values_t<int16_t> &output)
+    {
+      output.x = X::template counts<TRANSLATION_RANGE>(raw);
+      output.y = Y::template counts<TRANSLATION_RANGE>(raw);
+      output.z = Z::template counts<TRANSLATION_RANGE>(raw);
+      output.u = U::template counts<ROTATION_RANGE>(raw);
+      output.v = V::template counts<ROTATION_RANGE>(raw);
+      output.w = W::template counts<ROTATION_RANGE>(raw);
+    }
+  };
+}
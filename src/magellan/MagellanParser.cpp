@@ -1,80 +1,281 @@
 #include "MagellanParser.hpp"
 
-// delay between sending each character of a command
+// interval between sending each character of a command
 // can be used to slow down communication to the 
 // Magellan to compensate for missing flow control
-#define SEND_INTER_CHARACTER_DELAY 10 // ms; 0 to disable
+#define SEND_CHARACTER_INTERVAL 2000 // us; 0 to disable
 
 using namespace magellan_internal;
 
-uint8_t MagellanParser::decode_nibble(const char c)
-{
-  switch(c)
-  {
-    case '0': return 0;
-    case 'A': return 1;
-    case 'B': return 2;
-    case '3': return 3;
-    case 'D': return 4;
-    case '5': return 5;
-    case '6': return 6;
-    case 'G': return 7;
-    case 'H': return 8;
-    case '9': return 9;
-    case ':': return 10;
-    case 'K': return 11;
-    case '<': return 12;
-    case 'M': return 13;
-    case 'N': return 14;
-    case '?': return 15;
-    default: 
-    {
-      if (this->log != nullptr)
+// lookup table for decoding nibbles, generated at compile time from NIBBLE_CHARS
+// entries contain the nibble value or'd with NIBBLE_VALID, or 0 for invalid characters
+#define NIBBLE_ROW_4(c) nibble_table_entry(c), nibble_table_entry(c + 1), nibble_table_entry(c + 2), nibble_table_entry(c + 3)
+#define NIBBLE_ROW_16(c) NIBBLE_ROW_4(c), NIBBLE_ROW_4(c + 4), NIBBLE_ROW_4(c + 8), NIBBLE_ROW_4(c + 12)
+#define NIBBLE_ROW_64(c) NIBBLE_ROW_16(c), NIBBLE_ROW_16(c + 16), NIBBLE_ROW_16(c + 32), NIBBLE_ROW_16(c + 48)
+const uint8_t magellan_internal::NIBBLE_TABLE[256] PROGMEM = {
+  NIBBLE_ROW_64(0), NIBBLE_ROW_64(64), NIBBLE_ROW_64(128), NIBBLE_ROW_64(192)
+};
+
+static_assert(nibble_table_entry('0') == (0 | NIBBLE_VALID), "nibble table broken for '0'");
+static_assert(nibble_table_entry('?') == (15 | NIBBLE_VALID), "nibble table broken for '?'");
+static_assert(nibble_table_entry('8') == 0, "nibble table broken for '8'");
+
+int16_t MagellanParser::decode_signed_word(const uint16_t word)
+{
+  // first nibble only holds the sign
+  int16_t value = static_cast<int16_t>(word & 0x0FFF);
+  if ((word & 0x8000) == 0)
+  {
+    value = -(4096 - value);
+  }
+
+  return value;
+}
+
+bool MagellanParser::fold_character(const char c)
+{
+  switch (this->message_type)
+  {
+    case VERSION:
+    {
+      // keep the start of the version string, for logging
+      if (rx_len < (VERSION_BUFFER_SIZE - 1))
+      {
+        rx_data.version[rx_len] = c;
+      }
+
+      // match VERSION_MAGIC while streaming
+      // 'M' only appears at the start of VERSION_MAGIC, so a mismatch can restart at 0 or 1
+      if (version_match < (sizeof(VERSION_MAGIC) - 1))
+      {
+        if (c == VERSION_MAGIC[version_match])
+        {
+          version_match++;
+        }
+        else
+        {
+          version_match = (c == VERSION_MAGIC[0]) ? 1 : 0;
+        }
+      }
+
+      if (rx_len < 0xFF)
+      {
+        rx_len++;
+      }
+      return true;
+    }
+    case BEEP:
+    case ERROR:
+    {
+      // payload is not used, only count it
+      rx_len++;
+      return true;
+    }
+    default:
+    {
+      // fold nibble into the current word
+      // payload length is limited by payload_length(), so words cannot overflow
+      const uint8_t n = pgm_read_byte(&NIBBLE_TABLE[static_cast<uint8_t>(c)]);
+      if ((n & NIBBLE_VALID) == 0)
       {
-        this->log->print(F("[Magellan] decode_nibble() got unknown character: \""));
-        this->log->print(c);
-        this->log->println(F("\""));
+        return false;
       }
 
-      return 0;
+      uint16_t &word = rx_data.words[rx_len / 4];
+      word = (word << 4) | (n & 0x0F);
+      rx_len++;
+      return true;
     }
   }
 }
 
-int16_t MagellanParser::decode_signed_word(const char* buffer)
+uint8_t MagellanParser::update()
 {
-  const uint8_t n0 = decode_nibble(buffer[0]);
-  const uint8_t n1 = decode_nibble(buffer[1]);
-  const uint8_t n2 = decode_nibble(buffer[2]);
-  const uint8_t n3 = decode_nibble(buffer[3]);
+  // remember the current values, to report which of them actually changed
+  const bool was_ready = ready();
+  const int16_t old_x = this->x, old_y = this->y, old_z = this->z;
+  const int16_t old_u = this->u, old_v = this->v, old_w = this->w;
+  const uint16_t old_buttons = this->buttons;
+  const uint8_t old_translation_sensitivity = this->translation_sensitivity;
+  const uint8_t old_rotation_sensitivity = this->rotation_sensitivity;
+  const uint8_t old_mode = this->mode;
 
-  // combine nibbles
-  int16_t value = static_cast<int16_t>(n1 << 8 | n2 << 4 | n3);
+  update_init();
+  update_tx();
 
-  // apply sign
-  if ((n0 & 0x08) == 0)
+  // drain the RX backlog, up to the byte budget
+  this->merged_frames = 0;
+  for (uint8_t i = 0; i < RX_BYTE_BUDGET && this->serial->available() != 0; i++)
   {
-    value = -(4096 - value);
+    const char c = this->serial->read();
+    this->rx_activity = true;
+    this->last_rx_byte_millis = millis();
+    update_rx(c);
   }
 
-  return value;
+  apply_position();
+  update_adaptive_mode();
+
+  if (this->merged_frames > 0 && this->log != nullptr)
+  {
+    this->log->print(F("[Magellan] merged "));
+    this->log->print(this->merged_frames);
+    this->log->println(F(" position messages"));
+  }
+
+  uint8_t changed = CHANGED_NONE;
+  if (this->x != old_x || this->y != old_y || this->z != old_z)
+  {
+    changed |= CHANGED_TRANSLATION;
+  }
+  if (this->u != old_u || this->v != old_v || this->w != old_w)
+  {
+    changed |= CHANGED_ROTATION;
+  }
+  if (this->buttons != old_buttons)
+  {
+    changed |= CHANGED_BUTTONS;
+  }
+  if (this->translation_sensitivity != old_translation_sensitivity || this->rotation_sensitivity != old_rotation_sensitivity)
+  {
+    changed |= CHANGED_SENSITIVITY;
+  }
+  if (this->mode != old_mode)
+  {
+    changed |= CHANGED_MODE;
+  }
+  if (ready() != was_ready)
+  {
+    changed |= CHANGED_READY;
+  }
+
+  return changed;
 }
 
-bool MagellanParser::update()
+void MagellanParser::set_reporting_mode(const uint8_t mode)
 {
-  update_init();
+  this->requested_mode = mode;
+  if (this->init_state == DONE)
+  {
+    send_mode_command();
+  }
+}
 
-  if (this->serial->available() != 0)
+void MagellanParser::send_mode_command()
+{
+  const char command[] = {COMMAND_SET_MODE, NIBBLE_CHARS[this->requested_mode & 0x0F], MESSAGE_END, '\0'};
+  send_command(command);
+}
+
+void MagellanParser::set_null_radius(const uint8_t radius)
+{
+  this->requested_null_radius = radius & 0x0F;
+  if (ready())
   {
-    const char c = this->serial->read();
-    return update_rx(c);
+    send_null_radius_command();
+  }
+}
+
+void MagellanParser::send_null_radius_command()
+{
+  const char command[] = {COMMAND_SET_NULL_RADIUS, NIBBLE_CHARS[this->requested_null_radius], MESSAGE_END, '\0'};
+  send_command(command);
+}
+
+void MagellanParser::update_adaptive_mode()
+{
+#if ADAPTIVE_REPORTING_MODE
+  if (!this->adaptive_new_message)
+  {
+    return;
+  }
+  this->adaptive_new_message = false;
+
+  // don't switch during init, or while a mode switch is still pending
+  if (this->init_state != DONE || this->mode != this->requested_mode)
+  {
+    return;
+  }
+
+  const uint32_t now = millis();
+  if ((now - this->last_mode_switch_millis) < ADAPTIVE_MIN_SWITCH_INTERVAL)
+  {
+    return;
+  }
+
+  const uint16_t translation = abs(this->x) + abs(this->y) + abs(this->z);
+  const uint16_t rotation = abs(this->u) + abs(this->v) + abs(this->w);
+
+  uint8_t next_mode = this->mode;
+  if (this->mode == MODE_TRANSLATION_ROTATION)
+  {
+    // count consecutive messages dominated by one group
+    if (translation >= ADAPTIVE_ENTER_MAGNITUDE && translation >= (rotation * ADAPTIVE_DOMINANCE_RATIO))
+    {
+      if (this->adaptive_streak < 0)
+      {
+        this->adaptive_streak = 0;
+      }
+      this->adaptive_streak++;
+    }
+    else if (rotation >= ADAPTIVE_ENTER_MAGNITUDE && rotation >= (translation * ADAPTIVE_DOMINANCE_RATIO))
+    {
+      if (this->adaptive_streak > 0)
+      {
+        this->adaptive_streak = 0;
+      }
+      this->adaptive_streak--;
+    }
+    else
+    {
+      this->adaptive_streak = 0;
+    }
+
+    if (this->adaptive_streak >= ADAPTIVE_ENTER_MESSAGES)
+    {
+      next_mode = MODE_TRANSLATION;
+    }
+    else if (this->adaptive_streak <= -ADAPTIVE_ENTER_MESSAGES)
+    {
+      next_mode = MODE_ROTATION;
+    }
+  }
+  else
+  {
+    // the other group is not visible in single group mode.
+    // go back to full mode when the active group calms down, or periodically to check the other group
+    const uint16_t active = (this->mode == MODE_TRANSLATION) ? translation : rotation;
+    if (active < ADAPTIVE_EXIT_MAGNITUDE || (now - this->last_mode_switch_millis) >= ADAPTIVE_MAX_DWELL)
+    {
+      next_mode = MODE_TRANSLATION_ROTATION;
+    }
   }
 
-  return false;
+  if (next_mode != this->mode)
+  {
+    if (this->log != nullptr)
+    {
+      this->log->print(F("[Magellan] adaptive mode switch: "));
+      this->log->print(this->mode);
+      this->log->print(F(" -> "));
+      this->log->println(next_mode);
+    }
+
+    this->adaptive_streak = 0;
+    this->last_mode_switch_millis = now;
+    set_reporting_mode(next_mode);
+  }
+#endif
 }
 
 void MagellanParser::update_init()
 {
+  // stop waiting for the next probe as soon as the space mouse responds
+  if (this->init_state == DETECT && this->rx_activity)
+  {
+    this->init_wait_until = 0;
+  }
+
   // should we wait?
   const uint32_t now = millis();
   if (now < this->init_wait_until)
@@ -84,9 +285,10 @@ void MagellanParser::update_init()
 
   // if more than 5 seconds have passed since the last reset, we're probably stuck
   // try resetting the device and starting over
-  // do not trigger a re-init when we're already in the reset state OR when we're done
+  // do not trigger a re-init when we're still detecting, already in the reset state OR when we're done.
+  // once done, the link is monitored separately
   const bool stuck = (now - this->last_reset_millis) > READY_WAIT_TIMEOUT;
-  if (stuck && this->init_state != RESET && this->init_state != DONE)
+  if (stuck && this->init_state > RESET && this->init_state < DONE)
   {
     if (this->log != nullptr)
     {
@@ -101,211 +303,354 @@ void MagellanParser::update_init()
 
   switch(this->init_state)
   {
-    case RESET:
-    {
-      this->send_command(COMMAND_RESET);
-      this->init_wait_until = now + 500; // wait 500 ms
-      this->last_reset_millis = now;
-      this->init_state = REQUEST_VERSION;
-      break;
-    }
-    case REQUEST_VERSION:
+    case DETECT:
     {
+      // any activity on the line means the space mouse is powered up
+      if (this->rx_activity)
+      {
+        if (this->log != nullptr)
+        {
+          this->log->print(F("[Magellan] detected space mouse after "));
+          this->log->print(now - this->begin_millis);
+          this->log->println(F(" ms"));
+        }
+
+        // drop probes that were not sent yet.
+        // COMMAND_RESET starts with MESSAGE_END, so a partially sent probe is terminated
+        this->tx_tail = this->tx_head;
+        this->init_step_millis = now;
+        this->init_state = RESET;
+        break;
+      }
+
+      // probe, then back off
       this->send_command(COMMAND_GET_VERSION);
-      this->init_state = WAIT_VERSION;
-      break;
-    }
-    case WAIT_VERSION:
-    {
-      // wait for version message
-      // this state is advanced in process_message()
+      this->init_wait_until = now + this->detect_probe_interval;
+      this->detect_probe_interval *= 2;
+      if (this->detect_probe_interval > DETECT_PROBE_MAX_INTERVAL)
+      {
+        this->detect_probe_interval = DETECT_PROBE_MAX_INTERVAL;
+      }
       break;
     }
-    case REQUEST_BUTTON_REPORTING:
+    case RESET:
     {
-      this->send_command(COMMAND_ENABLE_BUTTON_REPORTING);
-      
-      // FIXME: can't implement WAIT_BUTTON_REPORTING since idk how the space mouse
-      // ACKs the command, so just wait a bit and hope for the best...
-
-      // this->init_state = WAIT_BUTTON_REPORTING;
-      this->init_wait_until = now + 500; // wait 500 ms
-      this->init_state = REQUEST_SET_MODE;
+      // let the space mouse finish answering the detection probes first
+      const bool quiet = (now - this->last_rx_byte_millis) >= RESET_QUIET_TIME
+        && (micros() - this->tx_last_micros) >= (RESET_QUIET_TIME * 1000UL);
+      if (!quiet && (now - this->init_step_millis) < RESET_TIMEOUT)
+      {
+        break;
+      }
 
+      this->send_command(COMMAND_RESET);
+      this->init_acks = 0;
+      memset(&this->init_timing, 0, sizeof(this->init_timing));
+      this->init_step_millis = now;
+      this->last_reset_millis = now;
+      this->init_state = WAIT_RESET;
       break;
     }
-    case WAIT_BUTTON_REPORTING:
+    case WAIT_RESET:
     {
-      // wait for button reporting to be enabled
-      // this state is advanced in process_message()
+      // the space mouse answers the reset with its version.
+      // in that case, there is no need to request it again
+      if (init_acked(INIT_STEP_RESET))
+      {
+        ack_init_step(INIT_STEP_VERSION);
+        this->init_state = REQUEST_CONFIG;
+        break;
+      }
+
+      if ((now - this->init_step_millis) >= RESET_TIMEOUT)
+      {
+        this->init_timing.step[INIT_STEP_RESET] = RESET_TIMEOUT;
+        this->init_state = REQUEST_VERSION;
+      }
       break;
     }
-    case REQUEST_SET_MODE:
+    case REQUEST_VERSION:
     {
-      this->send_command(COMMAND_SET_MODE3);
-      this->init_state = WAIT_SET_MODE;
+      this->send_command(COMMAND_GET_VERSION);
+      this->init_step_millis = now;
+      this->init_state = WAIT_VERSION;
       break;
     }
-    case WAIT_SET_MODE:
+    case WAIT_VERSION:
     {
-      // wait for mode to be set
-      // mode is parsed in process_message()
-      if (this->mode == 3)
+      // wait for version message, acknowledged in process_version()
+      if (init_acked(INIT_STEP_VERSION))
       {
-        this->init_state = REQUEST_SET_SENSITIVITY;
+        this->init_state = REQUEST_CONFIG;
+      }
+      else if ((now - this->init_step_millis) >= INIT_ACK_TIMEOUT)
+      {
+        // ask again
+        this->init_state = REQUEST_VERSION;
       }
       break;
     }
-    case REQUEST_SET_SENSITIVITY:
+    case REQUEST_CONFIG:
     {
-      // set sensitivity to 7 for both translation and rotation
+      // these commands are independent of each other, so send them all at once
+      // and wait for the acknowledgements in any order
+      this->init_acks &= ~INIT_CONFIG_ACKS;
+      this->init_step_millis = now;
+      this->send_command(COMMAND_ENABLE_BUTTON_REPORTING);
+      this->send_mode_command();
       this->send_command(COMMAND_SET_SENSITIVITY);
-      this->init_state = WAIT_SET_SENSITIVITY;
+      this->send_null_radius_command();
+      this->send_command(COMMAND_ZERO);
+      this->init_state = WAIT_CONFIG;
       break;
     }
-    case WAIT_SET_SENSITIVITY:
+    case WAIT_CONFIG:
     {
-      // wait for sensitivity to be set
-      // sensitivity is parsed in process_message()
-      if (this->translation_sensitivity == 7 && this->rotation_sensitivity == 7)
+      // acknowledgements are recorded in process_message()
+      if ((this->init_acks & INIT_CONFIG_ACKS) == INIT_CONFIG_ACKS)
       {
-        this->init_state = REQUEST_ZERO;
+        finish_init(now);
+        break;
+      }
+
+      if ((now - this->init_step_millis) >= INIT_ACK_TIMEOUT)
+      {
+        const uint8_t missing = INIT_CONFIG_ACKS & ~this->init_acks;
+        if ((missing & ~INIT_OPTIONAL_ACKS) == 0)
+        {
+          // button reporting and null radius are not acknowledged by all space mice, assume they worked
+          for (uint8_t step = 0; step < INIT_STEP_COUNT; step++)
+          {
+            if ((missing & init_ack_bit(static_cast<init_step_t>(step))) != 0)
+            {
+              this->init_timing.step[step] = INIT_ACK_TIMEOUT;
+            }
+          }
+          finish_init(now);
+        }
+        else
+        {
+          // try again
+          this->init_state = REQUEST_CONFIG;
+        }
       }
       break;
     }
-    case REQUEST_ZERO:
+    case DONE:
     {
-      this->send_command(COMMAND_ZERO);
-      this->init_state = WAIT_ZERO;
+      // initialization is complete.
+      // the space mouse only sends messages while it is moved, so probe it when the line goes quiet
+      if ((now - this->last_rx_millis) >= LINK_QUIET_TIMEOUT)
+      {
+        send_link_probe(now);
+        this->init_state = PROBE_LINK;
+      }
       break;
     }
-    case WAIT_ZERO:
+    case PROBE_LINK:
     {
-      // wait for zero command to be acknowledged
-      // this state is advanced in process_message()
+      if (this->probe_answered)
+      {
+        // a different mode is expected while a mode switch is in flight, or if the mode command was lost.
+        // only the mode is sent again, so the link stays ready.
+        // a power cycled space mouse stops answering the probes, and is fully re-configured from LINK_DOWN
+        if (this->mode != this->requested_mode)
+        {
+          if (this->log != nullptr)
+          {
+            this->log->println(F("[Magellan] mode mismatch, sending mode again"));
+          }
+
+          send_mode_command();
+        }
+
+        this->init_state = DONE;
+        break;
+      }
+
+      if ((now - this->init_step_millis) >= LINK_PROBE_TIMEOUT)
+      {
+        if (this->log != nullptr)
+        {
+          this->log->println(F("[Magellan] link down"));
+        }
+
+        // don't keep stale values around while the link is down
+        clear_values();
+        this->init_state = LINK_DOWN;
+      }
       break;
     }
-    case DONE:
+    case LINK_DOWN:
     {
-      // initialization is complete
+      if (this->probe_answered)
+      {
+        // the space mouse may have been power cycled, so configure it again.
+        // reset and version are not needed, since it answered the probe
+        if (this->log != nullptr)
+        {
+          this->log->println(F("[Magellan] link restored, re-configuring..."));
+        }
+
+        restart_config(now);
+        break;
+      }
+
+      // keep probing
+      if ((now - this->init_step_millis) >= LINK_PROBE_TIMEOUT)
+      {
+        send_link_probe(now);
+      }
       break;
     }
     default:
     {
       // unknown state, reset to RESET
+      this->init_step_millis = now;
       this->init_state = RESET;
       break;
     }
   }
 }
 
+void MagellanParser::send_link_probe(const uint32_t now)
+{
+  this->send_command(COMMAND_GET_MODE);
+  this->probe_answered = false;
+  this->init_step_millis = now;
+}
+
+void MagellanParser::restart_config(const uint32_t now)
+{
+  // restart the timeout for getting stuck, falls back to a full reset
+  this->last_reset_millis = now;
+  this->init_state = REQUEST_CONFIG;
+}
+
+void MagellanParser::ack_init_step(const init_step_t step)
+{
+  if (this->init_state == DONE || init_acked(step))
+  {
+    return;
+  }
+
+  this->init_acks |= init_ack_bit(step);
+  this->init_timing.step[step] = millis() - this->init_step_millis;
+}
+
+void MagellanParser::finish_init(const uint32_t now)
+{
+  this->init_state = DONE;
+  this->last_rx_millis = now;
+  this->init_timing.total = now - this->last_reset_millis;
+
+  // record time to ready, only for the first init
+  if (this->time_to_ready == 0)
+  {
+    this->time_to_ready = now - this->begin_millis;
+  }
+
+  if (this->log != nullptr)
+  {
+    this->log->print(F("[Magellan] ready after "));
+    this->log->print(now - this->begin_millis);
+    this->log->print(F(" ms. init steps (ms):"));
+    for (uint8_t i = 0; i < INIT_STEP_COUNT; i++)
+    {
+      this->log->print(F(" "));
+      this->log->print(this->init_timing.step[i]);
+    }
+    this->log->print(F(", total "));
+    this->log->println(this->init_timing.total);
+  }
+}
+
 bool MagellanParser::update_rx(const char c)
 {
+  // line errors are reported in-band by MagellanSerial
+  if (static_cast<uint8_t>(c) == RX_MARKER_FRAMING_ERROR || static_cast<uint8_t>(c) == RX_MARKER_OVERRUN)
+  {
+    handle_line_error(static_cast<uint8_t>(c));
+    return false;
+  }
+
   switch(this->rx_state)
   {
     case IDLE:
     {
-      // reset message buffer
-      rx_len = 0;
-      
-      switch(c)
+      // MESSAGE_END of a fixed-length message that was already dispatched
+      if (c == MESSAGE_END)
       {
-        case 'v':
-        {
-          // version message
-          this->message_type = VERSION;
-          break;
-        }
-        case 'k':
-        {
-          // keypress message
-          this->message_type = KEYPRESS;
-          break;
-        }
-        case 'd':
-        {
-          // position and rotation message
-          this->message_type = POSITION_ROTATION;
-          break;
-        }
-        case 'm':
-        {
-          // mode change message
-          this->message_type = MODE_CHANGE;
-          break;
-        }
-        case 'z':
-        {
-          // zeroed message
-          this->message_type = ZERO;
-          break;
-        }
-        case 'q':
-        {
-          // sensitivity change message
-          this->message_type = SENSITIVITY_CHANGE;
-          break;
-        }
-        default:
-        {
-          // unknown message
-          this->message_type = UNKNOWN;
-
-          if (this->log != nullptr)
-          {
-            this->log->print(F("[Magellan] got unknown message type: \""));
-            this->log->print(c);
-            this->log->println(F("\""));
-          }
+        return false;
+      }
 
-          break;
-        }
+      if (begin_message(c))
+      {
+        return dispatch_if_complete();
       }
 
-      if (this->log != nullptr)
+      // not a message type, we lost sync
+      enter_resync();
+      return false;
+    }
+    case RESYNC:
+    {
+      // drop everything until a plausible message type
+      if (begin_message(c))
       {
-        this->log->print("[Magellan] got message type: ");
-        this->log->println(this->message_type);
+        return dispatch_if_complete();
       }
-      
-      this->rx_state = READ_MESSAGE;
+
+      this->link_stats.bytes_discarded++;
       return false;
     }
     case READ_MESSAGE:
     {
-      // is this the end of the message?
-      if (c == MESSAGE_END)
+      // variable-length messages end at MESSAGE_END
+      if (this->rx_expected_len == PAYLOAD_VARIABLE_LENGTH)
       {
-        this->rx_state = IDLE; // prepare for next message
+        if (c == MESSAGE_END)
+        {
+          this->rx_state = IDLE;
+          return process_message(this->message_type, rx_len);
+        }
+
+        if (rx_len >= MAX_VARIABLE_PAYLOAD_LENGTH)
+        {
+          // MESSAGE_END was probably lost
+          this->link_stats.frames_lost++;
+          enter_resync();
+          return false;
+        }
 
-        rx_buffer[rx_len] = '\0'; // ensure null-termination
-        return process_message(this->message_type, rx_buffer, rx_len);
+        fold_character(c);
+        return false;
       }
 
-      // add character to buffer
-      // always leave one character for null-termination
-      if (rx_len < (sizeof(rx_buffer) - 1))
+      // fixed-length messages are dispatched as soon as the payload is complete
+      if (fold_character(c))
       {
-        rx_buffer[rx_len++] = c;
+        return dispatch_if_complete();
       }
-      else
-      {
-        // buffer overflow, wait until the message ends and drop it
-        this->rx_state = WAIT_MESSAGE_END;
 
-        if (this->log != nullptr)
-        {
-          this->log->println(F("[Magellan] buffer overflow, entering WAIT_MESSAGE_END state"));
-        }
-      }
-      return false;
-    }
-    case WAIT_MESSAGE_END:
-    {
+      // invalid payload character, the message is lost
+      this->link_stats.frames_lost++;
       if (c == MESSAGE_END)
       {
+        // message ended early, next byte should be a message type
         this->rx_state = IDLE;
+        return false;
       }
+
+      // the character may already be the start of the next message
+      this->link_stats.decode_errors++;
+      if (begin_message(c))
+      {
+        this->link_stats.resyncs++;
+        return dispatch_if_complete();
+      }
+
+      enter_resync();
       return false;
     }
     default:
@@ -317,7 +662,120 @@ bool MagellanParser::update_rx(const char c)
   }
 }
 
-void MagellanParser::send_command(const char* command)
+uint8_t MagellanParser::payload_length(const char type) const
+{
+  switch(type)
+  {
+    case VERSION: return PAYLOAD_VARIABLE_LENGTH;
+    case BEEP: return PAYLOAD_VARIABLE_LENGTH;
+    case ERROR: return PAYLOAD_VARIABLE_LENGTH;
+    case KEYPRESS: return 3;
+    case POSITION_ROTATION:
+    {
+      // shorter payload when only translation or rotation is reported
+      return (this->mode == MODE_TRANSLATION || this->mode == MODE_ROTATION)
+        ? POSITION_PAYLOAD_LENGTH_SINGLE
+        : POSITION_PAYLOAD_LENGTH_FULL;
+    }
+    case MODE_CHANGE: return 1;
+    case SENSITIVITY_CHANGE: return 2;
+    case ZERO: return 0;
+    case NULL_RADIUS: return 1;
+    default: return PAYLOAD_UNKNOWN_TYPE;
+  }
+}
+
+bool MagellanParser::begin_message(const char c)
+{
+  const uint8_t len = payload_length(c);
+  if (len == PAYLOAD_UNKNOWN_TYPE)
+  {
+    return false;
+  }
+
+  // reset message accumulator
+  this->message_type = static_cast<message_type_t>(c);
+  this->rx_expected_len = len;
+  this->rx_len = 0;
+  this->version_match = 0;
+  memset(&rx_data, 0, sizeof(rx_data));
+
+  // only a version message that starts after the reset command was sent can answer the reset
+  this->version_after_reset = this->init_state == WAIT_RESET && this->tx_head == this->tx_tail;
+
+  if (this->log != nullptr)
+  {
+    this->log->print(F("[Magellan] got message type: "));
+    this->log->println(c);
+  }
+
+  this->rx_state = READ_MESSAGE;
+  return true;
+}
+
+bool MagellanParser::dispatch_if_complete()
+{
+  if (rx_len < rx_expected_len)
+  {
+    return false;
+  }
+
+  this->rx_state = IDLE; // prepare for next message
+  return process_message(this->message_type, rx_len);
+}
+
+void MagellanParser::enter_resync()
+{
+  if (this->log != nullptr)
+  {
+    this->log->println(F("[Magellan] lost sync, entering RESYNC state"));
+  }
+
+  this->link_stats.resyncs++;
+  this->link_stats.bytes_discarded++;
+  this->rx_state = RESYNC;
+}
+
+void MagellanParser::handle_line_error(const uint8_t marker)
+{
+  if (marker == RX_MARKER_FRAMING_ERROR)
+  {
+    this->link_stats.framing_errors++;
+  }
+  else
+  {
+    this->link_stats.overruns++;
+  }
+
+  if (this->log != nullptr)
+  {
+    this->log->println(marker == RX_MARKER_FRAMING_ERROR ? F("[Magellan] UART framing error") : F("[Magellan] UART overrun"));
+  }
+
+  // the current message is corrupted. 
+  // the next byte may already be a message type, so don't enter RESYNC yet
+  if (this->rx_state == READ_MESSAGE)
+  {
+    this->link_stats.frames_lost++;
+  }
+
+  this->rx_state = IDLE;
+}
+
+bool MagellanParser::enqueue_tx(const char c)
+{
+  const uint8_t next = (this->tx_head + 1) % TX_QUEUE_SIZE;
+  if (next == this->tx_tail)
+  {
+    return false;
+  }
+
+  this->tx_queue[this->tx_head] = c;
+  this->tx_head = next;
+  return true;
+}
+
+bool MagellanParser::send_command(const char* command)
 {
   if (this->log != nullptr)
   {
@@ -326,31 +784,85 @@ void MagellanParser::send_command(const char* command)
     this->log->println(F(")"));
   }
 
-  #if SEND_INTER_CHARACTER_DELAY > 0
-    // write each character individually, with a delay between each
+  // only queue complete commands
+  if (strlen(command) > tx_free())
+  {
+    if (this->log != nullptr)
+    {
+      this->log->println(F("[Magellan] TX queue full, command dropped"));
+    }
+
+    return false;
+  }
+
+  for (uint8_t i = 0; command[i] != '\0'; i++)
+  {
+    enqueue_tx(command[i]);
+  }
+
+  return true;
+}
+
+bool MagellanParser::send_pause(const uint8_t duration)
+{
+  if (tx_free() < 2)
+  {
+    return false;
+  }
+
+  enqueue_tx(TX_PAUSE_MARKER);
+  enqueue_tx(static_cast<char>(duration));
+  return true;
+}
+
+void MagellanParser::update_tx()
+{
+  while (this->tx_head != this->tx_tail)
+  {
+    // wait for the previous character or pause
+    const uint32_t now = micros();
+    if ((now - this->tx_last_micros) < this->tx_wait_micros)
+    {
+      return;
+    }
+
+    const char c = this->tx_queue[this->tx_tail];
+    if (c == TX_PAUSE_MARKER)
+    {
+      // pause duration follows the marker
+      const uint8_t duration_index = (this->tx_tail + 1) % TX_QUEUE_SIZE;
+      this->tx_wait_micros = static_cast<uint8_t>(this->tx_queue[duration_index]) * 1000UL;
+      this->tx_last_micros = now;
+      this->tx_tail = (duration_index + 1) % TX_QUEUE_SIZE;
+      continue;
+    }
+
+    // don't block if the serial TX buffer is full
+    if (this->serial->availableForWrite() <= 0)
+    {
+      return;
+    }
+
     // the Magellan normally uses hardware flow control, but the hardware 
     // isn't set up for it...
-    for (uint8_t i = 0; command[i] != '\0'; i++)
-    {
-      this->serial->write(command[i]);
-      this->serial->flush();
-      delay(1);
-    } 
-  #else
-    this->serial->print(command);
-    this->serial->flush();
-  #endif
+    this->serial->write(c);
+    this->tx_tail = (this->tx_tail + 1) % TX_QUEUE_SIZE;
+    this->tx_last_micros = now;
+    this->tx_wait_micros = SEND_CHARACTER_INTERVAL;
+  }
 }
 
-bool MagellanParser::process_message(const message_type_t type, const char* payload, const uint8_t len)
+bool MagellanParser::process_message(const message_type_t type, const uint8_t len)
 {
+  // any complete message means the link is alive
+  this->last_rx_millis = millis();
+  this->probe_answered = true;
+
   if (this->log != nullptr)
   {
     this->log->print(F("[Magellan] process_message("));
     this->log->print(static_cast<char>(type));
-    this->log->print(F(", \""));
-    this->log->print(payload);
-    this->log->print(F("\", "));
+    this->log->print(F(", "));
     this->log->print(len);
     this->log->println(F(")"));
   }
@@ -359,27 +871,40 @@ bool MagellanParser::process_message(const message_type_t type, const char* payl
   {
     case VERSION:
     {
-      return process_version(payload, len);
+      return process_version(len);
     }
     case KEYPRESS:
     {
-      return process_keypress(payload, len);
+      return process_keypress(len);
     }
     case POSITION_ROTATION:
     {
-      return process_position_rotation(payload, len);
+      return process_position_rotation(len);
     }
     case MODE_CHANGE:
     {
-      return process_mode_change(payload, len);
+      return process_mode_change(len);
     }
     case ZERO:
     {
-      return process_zero(payload, len);
+      return process_zero(len);
     }
     case SENSITIVITY_CHANGE:
     {
-      return process_sensitivity_change(payload, len);
+      return process_sensitivity_change(len);
+    }
+    case NULL_RADIUS:
+    {
+      return process_null_radius(len);
+    }
+    case BEEP:
+    {
+      // echo of COMMAND_BEEP, nothing to do
+      return true;
+    }
+    case ERROR:
+    {
+      return process_error(len);
     }
     default:
     {
@@ -389,16 +914,16 @@ bool MagellanParser::process_message(const message_type_t type, const char* payl
   }
 }
 
-bool MagellanParser::process_version(const char* payload, const uint8_t len)
+bool MagellanParser::process_version(const uint8_t len)
 {
   if (this->log != nullptr)
   {
     this->log->print(F("[Magellan] got version \""));
-    this->log->print(payload);
+    this->log->print(rx_data.version);
   }
 
   // validate version includes 'MAGELLAN'
-  if (strstr(payload, VERSION_MAGIC) == nullptr)
+  if (version_match != (sizeof(VERSION_MAGIC) - 1))
   {
     if (this->log != nullptr)
     {
@@ -413,15 +938,33 @@ bool MagellanParser::process_version(const char* payload, const uint8_t len)
     this->log->println(F("\" (OK)"));
   }
 
-  // advance init state if waiting for version
-  if (this->init_state == WAIT_VERSION)
+  // acknowledge init step. the reset is answered with the version, too.
+  // while waiting for the reset, a version message that started earlier answers a detection probe, ignore it
+  if (this->init_state != WAIT_RESET)
   {
-    this->init_state = REQUEST_BUTTON_REPORTING;
+    ack_init_step(INIT_STEP_VERSION);
+  }
+  else if (this->version_after_reset)
+  {
+    ack_init_step(INIT_STEP_RESET);
   }
   return true;
 }
 
-bool MagellanParser::process_mode_change(const char* payload, const uint8_t len)
+bool MagellanParser::process_error(const uint8_t len)
+{
+  this->link_stats.device_errors++;
+
+  if (this->log != nullptr)
+  {
+    this->log->print(F("[Magellan] space mouse reported an error, payload length "));
+    this->log->println(len);
+  }
+
+  return true;
+}
+
+bool MagellanParser::process_mode_change(const uint8_t len)
 {
   // expect 1 character in the payload
   if (len != 1)
@@ -429,7 +972,11 @@ bool MagellanParser::process_mode_change(const char* payload, const uint8_t len)
     return false;
   }
 
-  this->mode = decode_nibble(payload[0]);
+  this->mode = rx_data.words[0] & 0x0F;
+  if (this->mode == this->requested_mode)
+  {
+    ack_init_step(INIT_STEP_MODE);
+  }
 
   if (this->log != nullptr)
   {
@@ -440,7 +987,7 @@ bool MagellanParser::process_mode_change(const char* payload, const uint8_t len)
   return true;
 }
 
-bool MagellanParser::process_sensitivity_change(const char* payload, const uint8_t len)
+bool MagellanParser::process_sensitivity_change(const uint8_t len)
 {
   // expect 2 characters in the payload
   if (len != 2)
@@ -448,8 +995,12 @@ bool MagellanParser::process_sensitivity_change(const char* payload, const uint8
     return false;
   }
 
-  this->translation_sensitivity = decode_nibble(payload[0]);
-  this->rotation_sensitivity = decode_nibble(payload[1]);
+  this->translation_sensitivity = (rx_data.words[0] >> 4) & 0x0F;
+  this->rotation_sensitivity = rx_data.words[0] & 0x0F;
+  if (this->translation_sensitivity == 7 && this->rotation_sensitivity == 7)
+  {
+    ack_init_step(INIT_STEP_SENSITIVITY);
+  }
 
   if (this->log != nullptr)
   {
@@ -462,7 +1013,7 @@ bool MagellanParser::process_sensitivity_change(const char* payload, const uint8
   return true;
 }
 
-bool MagellanParser::process_zero(const char* payload, const uint8_t len)
+bool MagellanParser::process_zero(const uint8_t len)
 {
   // don't care about the payload, there should be none
   if (this->log != nullptr)
@@ -470,16 +1021,35 @@ bool MagellanParser::process_zero(const char* payload, const uint8_t len)
     this->log->println(F("[Magellan] got zeroed"));
   }
 
-  // advance init state if waiting for zero
-  if (this->init_state == WAIT_ZERO)
+  ack_init_step(INIT_STEP_ZERO);
+
+  return true;
+}
+
+bool MagellanParser::process_null_radius(const uint8_t len)
+{
+  // expect 1 character in the payload
+  if (len != 1)
+  {
+    return false;
+  }
+
+  this->null_radius = rx_data.words[0] & 0x0F;
+  if (this->null_radius == this->requested_null_radius)
   {
-    this->init_state = DONE;
+    ack_init_step(INIT_STEP_NULL_RADIUS);
+  }
+
+  if (this->log != nullptr)
+  {
+    this->log->print(F("[Magellan] got null radius: "));
+    this->log->println(this->null_radius);
   }
 
   return true;
 }
 
-bool MagellanParser::process_keypress(const char* payload, const uint8_t len)
+bool MagellanParser::process_keypress(const uint8_t len)
 {
   // expect 3 characters in the payload
   if (len != 3)
@@ -487,11 +1057,12 @@ bool MagellanParser::process_keypress(const char* payload, const uint8_t len)
     return false;
   }
 
-  const uint8_t k0 = decode_nibble(payload[0]);
-  const uint8_t k1 = decode_nibble(payload[1]);
-  const uint8_t k2 = decode_nibble(payload[2]);
+  // payload is folded as k0 k1 k2, but k0 holds the lowest bits
+  const uint16_t k = rx_data.words[0];
+  set_buttons((k & 0x00F) << 8 | (k & 0x0F0) | (k >> 8));
 
-  this->buttons = k2 << 8 | k1 << 4 | k0;
+  // the space mouse answers the enable button reporting command with the current button state
+  ack_init_step(INIT_STEP_BUTTONS);
 
   if (this->log != nullptr)
   {
@@ -502,41 +1073,113 @@ bool MagellanParser::process_keypress(const char* payload, const uint8_t len)
   return true;
 }
 
-bool MagellanParser::process_position_rotation(const char* payload, const uint8_t len)
+void MagellanParser::normalize_values()
 {
-  // expect 24 characters in the payload 
-  // (mode 3 = position and rotation)
-  if (len != 24)
+  this->pipeline(get_raw(), this->normalized);
+}
+
+void MagellanParser::set_buttons(const uint16_t new_buttons)
+{
+  const uint16_t changed = this->buttons ^ new_buttons;
+  if (changed == 0)
+  {
+    return;
+  }
+
+  // queue edges in ascending button order
+  const uint32_t now = millis();
+  for (uint8_t i = 0; i < BUTTON_COUNT; i++)
+  {
+    const uint16_t mask = 1 << i;
+    if ((changed & mask) != 0)
+    {
+      const button_edge_t edge = {now, i, (new_buttons & mask) != 0};
+      if (!this->button_edges.push(edge) && this->log != nullptr)
+      {
+        this->log->println(F("[Magellan] button edge queue overflow"));
+      }
+    }
+  }
+
+  this->buttons = new_buttons;
+}
+
+bool MagellanParser::process_position_rotation(const uint8_t len)
+{
+  if (len == POSITION_PAYLOAD_LENGTH_FULL)
+  {
+    // position and rotation
+    this->x = decode_signed_word(rx_data.words[0]);
+    this->y = decode_signed_word(rx_data.words[2]);
+    this->z = decode_signed_word(rx_data.words[1]);
+    this->u = decode_signed_word(rx_data.words[3]); // theta Y = rY
+    this->v = decode_signed_word(rx_data.words[5]); // theta X = rX
+    this->w = decode_signed_word(rx_data.words[4]); // theta Z = rZ
+  }
+  else if (len == POSITION_PAYLOAD_LENGTH_SINGLE && this->mode == MODE_TRANSLATION)
+  {
+    // position only, rotation is not reported.
+    // the short layouts are assumed to keep the word order of the full message, see POSITION_PAYLOAD_LENGTH_SINGLE
+    this->x = decode_signed_word(rx_data.words[0]);
+    this->y = decode_signed_word(rx_data.words[2]);
+    this->z = decode_signed_word(rx_data.words[1]);
+    this->u = 0;
+    this->v = 0;
+    this->w = 0;
+  }
+  else if (len == POSITION_PAYLOAD_LENGTH_SINGLE && this->mode == MODE_ROTATION)
+  {
+    // rotation only, position is not reported
+    this->x = 0;
+    this->y = 0;
+    this->z = 0;
+    this->u = decode_signed_word(rx_data.words[0]); // theta Y = rY
+    this->v = decode_signed_word(rx_data.words[2]); // theta X = rX
+    this->w = decode_signed_word(rx_data.words[1]); // theta Z = rZ
+  }
+  else
   {
     return false;
   }
 
-  // get raw values
-  this->x = decode_signed_word(payload + 0);
-  this->y = decode_signed_word(payload + 8);
-  this->z = decode_signed_word(payload + 4);
-  this->u = decode_signed_word(payload + 12); // theta Y = rY
-  this->v = decode_signed_word(payload + 20); // theta X = rX
-  this->w = decode_signed_word(payload + 16); // theta Z = rZ
+  this->adaptive_new_message = true;
+
+  // normalized once per update(), by apply_position().
+  // a previous message that was not normalized yet is superseded by this one
+  if (this->position_pending)
+  {
+    this->merged_frames++;
+  }
+  this->position_pending = true;
+  return true;
+}
+
+void MagellanParser::apply_position()
+{
+  if (!this->position_pending)
+  {
+    return;
+  }
+
+  this->position_pending = false;
+  normalize_values();
 
   if (this->log != nullptr)
   {
     #define PRINT_VALUE(name, normalized, raw)  \
       this->log->print(F(name "="));       \
-      this->log->print(normalized, 2);          \
+      this->log->print(normalized);             \
       this->log->print(F(" ("));                \
       this->log->print(raw);                    \
       this->log->print(F(")"))
 
     this->log->print(F("[Magellan] got position/rotation:"));
-    PRINT_VALUE("x", this->get_x(), this->x);
-    PRINT_VALUE(", y", this->get_y(), this->y);
-    PRINT_VALUE(", z", this->get_z(), this->z);
-    PRINT_VALUE(", u", this->get_u(), this->u);
-    PRINT_VALUE(", v", this->get_v(), this->v);
-    PRINT_VALUE(", w", this->get_w(), this->w);
+    PRINT_VALUE("x", this->get_x_q15(), this->x);
+    PRINT_VALUE(", y", this->get_y_q15(), this->y);
+    PRINT_VALUE(", z", this->get_z_q15(), this->z);
+    PRINT_VALUE(", u", this->get_u_q15(), this->u);
+    PRINT_VALUE(", v", this->get_v_q15(), this->v);
+    PRINT_VALUE(", w", this->get_w_q15(), this->w);
     this->log->println();
   }
-
-  return true;
 }
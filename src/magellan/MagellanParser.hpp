@@ -1,19 +1,144 @@
 #pragma once
 #include <Arduino.h>
 #include "util.hpp"
+#include "MagellanSerial.hpp"
+#include "../ButtonEdgeQueue.hpp"
+#include "AxisPipeline.hpp"
+
+// switch the reporting mode of the Magellan at runtime, when motion
+// is clearly dominated by either translation or rotation.
+// reduces message size, and thus increases the update rate of the active group.
+// experimental: the short message layout of modes 1 and 2 is not documented, and not verified on hardware.
+// while a single group is reported, the other group reads 0. that lasts at least ADAPTIVE_MIN_SWITCH_INTERVAL
+// and at most ADAPTIVE_MAX_DWELL, plus the time for the mode command to be answered.
+// can be set from the build flags, so the host tests cover it
+#ifndef ADAPTIVE_REPORTING_MODE
+#define ADAPTIVE_REPORTING_MODE 0 // 0 to disable
+#endif
 
 namespace magellan_internal
 {
   /**
-   * size of the message RX buffer
+   * baud rate of the serial link to the space mouse
+   */
+  constexpr uint32_t BAUD_RATE = 9600;
+
+  /**
+   * size of the buffer holding the version string, including null-termination
+   * @note longer version strings are truncated. VERSION_MAGIC is matched on the full string
+   */
+  constexpr uint8_t VERSION_BUFFER_SIZE = 16;
+
+  /**
+   * maximum number of 16-bit words in a nibble-encoded message payload
+   * @note position and rotation message in mode 3 has 6 words
+   */
+  constexpr uint8_t MAX_PAYLOAD_WORDS = 6;
+
+  /**
+   * maximum length of a variable-length message payload (version string, beep echo, error).
+   * @note longer messages are assumed to have lost their MESSAGE_END, and are dropped
+   */
+  constexpr uint8_t MAX_VARIABLE_PAYLOAD_LENGTH = 80;
+
+  /**
+   * payload length of messages that end at MESSAGE_END
+   */
+  constexpr uint8_t PAYLOAD_VARIABLE_LENGTH = 0xFF;
+
+  /**
+   * payload length returned for characters that are not a known message type
+   */
+  constexpr uint8_t PAYLOAD_UNKNOWN_TYPE = 0xFE;
+
+  /**
+   * maximum number of bytes read from the serial port per call to update().
+   * @note the RX backlog is drained up to this budget, so a slow loop() does not cause stale values.
+   * @note set to 1 to read only a single byte per update() call
+   */
+  constexpr uint8_t RX_BYTE_BUDGET = 64;
+
+  /**
+   * reporting mode flag: report translation (x, y, z)
+   */
+  constexpr uint8_t MODE_TRANSLATION = 1;
+
+  /**
+   * reporting mode flag: report rotation (u, v, w)
+   */
+  constexpr uint8_t MODE_ROTATION = 2;
+
+  /**
+   * reporting mode: report translation and rotation
+   */
+  constexpr uint8_t MODE_TRANSLATION_ROTATION = MODE_TRANSLATION | MODE_ROTATION;
+
+  /**
+   * payload length of a position and rotation message, when only translation or rotation is reported
+   * @note assumed to be the three words of the reported group, in the order of the full message. not verified on hardware
+   */
+  constexpr uint8_t POSITION_PAYLOAD_LENGTH_SINGLE = 12;
+
+  /**
+   * payload length of a position and rotation message, when both translation and rotation are reported
+   */
+  constexpr uint8_t POSITION_PAYLOAD_LENGTH_FULL = 24;
+
+  /**
+   * adaptive reporting mode: minimum magnitude (sum of absolute raw values) of the dominant group
+   */
+  constexpr uint16_t ADAPTIVE_ENTER_MAGNITUDE = 300;
+
+  /**
+   * adaptive reporting mode: the dominant group must be at least this many times larger than the other group
+   */
+  constexpr uint8_t ADAPTIVE_DOMINANCE_RATIO = 4;
+
+  /**
+   * adaptive reporting mode: number of consecutive dominated messages before switching to a single group
+   */
+  constexpr int8_t ADAPTIVE_ENTER_MESSAGES = 8;
+
+  /**
+   * adaptive reporting mode: go back to reporting both groups when the magnitude of the active group falls below this
+   * @note lower than ADAPTIVE_ENTER_MAGNITUDE for hysteresis
+   */
+  constexpr uint16_t ADAPTIVE_EXIT_MAGNITUDE = 100;
+
+  /**
+   * adaptive reporting mode: minimum time between two mode switches
    */
-  constexpr size_t MESSAGE_BUFFER_SIZE = 128;
+  constexpr uint32_t ADAPTIVE_MIN_SWITCH_INTERVAL = 250; // ms
+
+  /**
+   * adaptive reporting mode: maximum time to only report a single group.
+   * after this, both groups are reported again to check if the other group is moving
+   */
+  constexpr uint32_t ADAPTIVE_MAX_DWELL = 1000; // ms
 
   /**
    * number of buttons supported by the space mouse
    */
   constexpr uint8_t BUTTON_COUNT = 9;
 
+  /**
+   * number of slots in the button edge queue.
+   * must be a power of two, the queue holds one less edge than this
+   */
+  constexpr uint8_t BUTTON_EDGE_QUEUE_SIZE = 16;
+
+  /**
+   * change flags returned by MagellanParser::update().
+   * a flag is only set if the value actually differs from before the call
+   */
+  constexpr uint8_t CHANGED_NONE = 0;
+  constexpr uint8_t CHANGED_TRANSLATION = 1 << 0; // x, y or z
+  constexpr uint8_t CHANGED_ROTATION = 1 << 1;    // u, v or w
+  constexpr uint8_t CHANGED_BUTTONS = 1 << 2;     // any button
+  constexpr uint8_t CHANGED_SENSITIVITY = 1 << 3; // translation or rotation sensitivity
+  constexpr uint8_t CHANGED_MODE = 1 << 4;        // reporting mode
+  constexpr uint8_t CHANGED_READY = 1 << 5;       // ready()
+
   /**
    * message separator, added to the end of each message
    */
@@ -29,15 +154,21 @@ namespace magellan_internal
    */
   static const char COMMAND_GET_VERSION[] = "vQ\r";
 
+  /**
+   * get mode command
+   * @note used to probe the space mouse, since it is cheap and answered immediately
+   */
+  static const char COMMAND_GET_MODE[] = "mQ\r";
+
   /**
    * enable button reporting command
    */
   static const char COMMAND_ENABLE_BUTTON_REPORTING[] = "kQ\r";
 
   /**
-   * set mode 3 command
+   * set mode command prefix. followed by the nibble-encoded mode and MESSAGE_END
    */
-  static const char COMMAND_SET_MODE3[] = "m3\r";
+  constexpr char COMMAND_SET_MODE = 'm';
 
   /**
    * set sensitivity command
@@ -45,6 +176,17 @@ namespace magellan_internal
    */
   static const char COMMAND_SET_SENSITIVITY[] = "qGG\r";
 
+  /**
+   * set null radius command prefix. followed by the nibble-encoded radius and MESSAGE_END
+   * @note movements within the null radius are suppressed by the space mouse itself
+   */
+  constexpr char COMMAND_SET_NULL_RADIUS = 'n';
+
+  /**
+   * default null radius, 0-15
+   */
+  constexpr uint8_t DEFAULT_NULL_RADIUS = 2;
+
   /**
    * zero command
    */
@@ -55,6 +197,50 @@ namespace magellan_internal
    */
   static const char COMMAND_BEEP[] = "b\r";
 
+  /**
+   * delay between the two beeps of beep()
+   */
+  constexpr uint8_t BEEP_PAUSE = 100; // ms
+
+  /**
+   * size of the command TX queue
+   */
+  constexpr uint8_t TX_QUEUE_SIZE = 32;
+
+  /**
+   * marker in the TX queue for a pause. followed by the pause duration in milliseconds
+   * @note commands only contain printable ASCII and MESSAGE_END, so this cannot collide
+   */
+  constexpr char TX_PAUSE_MARKER = '\x01';
+
+  /**
+   * characters used to encode nibbles on the wire, indexed by nibble value
+   * @note the low 4 bits of each character are the nibble value
+   */
+  constexpr char NIBBLE_CHARS[] = "0AB3D56GH9:K<MN?";
+
+  /**
+   * flag set in the nibble lookup table for characters that are valid nibbles
+   */
+  constexpr uint8_t NIBBLE_VALID = 0x10;
+
+  /**
+   * calculate a single entry of the nibble lookup table
+   * @param c the character to decode
+   * @return the nibble value, or'd with NIBBLE_VALID. 0 if c is not a valid nibble character
+   * @note used to generate the lookup table at compile time
+   */
+  constexpr uint8_t nibble_table_entry(const uint8_t c)
+  {
+    return (c == static_cast<uint8_t>(NIBBLE_CHARS[c & 0x0F])) ? ((c & 0x0F) | NIBBLE_VALID) : 0;
+  }
+
+  /**
+   * nibble lookup table, indexed by character. entries are nibble_table_entry() of the index
+   * @note in PROGMEM, read using pgm_read_byte()
+   */
+  extern const uint8_t NIBBLE_TABLE[256] PROGMEM;
+
   /**
    * magic string that must be included in the version response
    */
@@ -62,10 +248,110 @@ namespace magellan_internal
 
   /**
    * timeout for waiting for the space mouse to be ready
-   * @note starts at INIT_RESET and is cleared when space mouse reports version and mode 3
+   * @note starts at INIT_RESET and is cleared when space mouse reports version and the requested mode
    */
   constexpr uint32_t READY_WAIT_TIMEOUT = 5000; // 5 seconds
 
+  /**
+   * how long to wait for the space mouse to answer the reset command, before requesting the version
+   */
+  constexpr uint32_t RESET_TIMEOUT = 500; // ms
+
+  /**
+   * before sending the reset command, wait until nothing was sent or received for this long.
+   * lets the space mouse finish answering the detection probes, so that answer is not taken for the answer to the reset
+   * @note waits at most RESET_TIMEOUT
+   */
+  constexpr uint32_t RESET_QUIET_TIME = 50; // ms
+
+  /**
+   * how long to wait for an acknowledgement during the init sequence, before retrying
+   */
+  constexpr uint32_t INIT_ACK_TIMEOUT = 500; // ms
+
+  /**
+   * steps of the init sequence that are acknowledged by the space mouse
+   */
+  enum init_step_t : uint8_t
+  {
+    INIT_STEP_RESET,       // reset, answered with the version
+    INIT_STEP_VERSION,     // get version
+    INIT_STEP_BUTTONS,     // enable button reporting, answered with the button state
+    INIT_STEP_MODE,        // set mode
+    INIT_STEP_SENSITIVITY, // set sensitivity
+    INIT_STEP_NULL_RADIUS, // set null radius
+    INIT_STEP_ZERO,        // zero
+    INIT_STEP_COUNT
+  };
+
+  /**
+   * get the bit of an init step in the acknowledgement bit mask
+   */
+  constexpr uint8_t init_ack_bit(const init_step_t step)
+  {
+    return 1 << step;
+  }
+
+  /**
+   * acknowledgements required to complete the config part of the init sequence
+   */
+  constexpr uint8_t INIT_CONFIG_ACKS = init_ack_bit(INIT_STEP_BUTTONS) | init_ack_bit(INIT_STEP_MODE) | init_ack_bit(INIT_STEP_SENSITIVITY) | init_ack_bit(INIT_STEP_NULL_RADIUS) | init_ack_bit(INIT_STEP_ZERO);
+
+  /**
+   * acknowledgements of INIT_CONFIG_ACKS that not all space mice send.
+   * when only these are missing after INIT_ACK_TIMEOUT, the commands are assumed to have worked
+   */
+  constexpr uint8_t INIT_OPTIONAL_ACKS = init_ack_bit(INIT_STEP_BUTTONS) | init_ack_bit(INIT_STEP_NULL_RADIUS);
+
+  /**
+   * timing of the last init sequence, for finding slow space mice
+   */
+  struct init_timing_t
+  {
+    // time from sending a step's command until it was acknowledged, indexed by init_step_t.
+    // steps that timed out hold the timeout, skipped steps hold 0
+    uint16_t step[INIT_STEP_COUNT];
+
+    // time from sending the reset command until the init sequence completed
+    uint16_t total;
+  };
+
+  /**
+   * probe the space mouse when no message was received for this long, after the init sequence completed
+   */
+  constexpr uint32_t LINK_QUIET_TIMEOUT = 500; // ms
+
+  /**
+   * the link is considered down when a probe is not answered within this time.
+   * also the interval between probes while the link is down
+   */
+  constexpr uint32_t LINK_PROBE_TIMEOUT = 150; // ms
+
+  /**
+   * initial interval between probes while waiting for the space mouse to power up
+   * @note doubled after each probe, up to DETECT_PROBE_MAX_INTERVAL
+   */
+  constexpr uint32_t DETECT_PROBE_INITIAL_INTERVAL = 50; // ms
+
+  /**
+   * maximum interval between probes while waiting for the space mouse to power up
+   */
+  constexpr uint32_t DETECT_PROBE_MAX_INTERVAL = 800; // ms
+
+  /**
+   * statistics about the quality of the serial link
+   */
+  struct link_stats_t
+  {
+    uint16_t resyncs;         // number of times the RX framer lost sync
+    uint16_t bytes_discarded; // number of bytes dropped while out of sync
+    uint16_t frames_lost;     // number of messages dropped due to invalid or missing data
+    uint16_t decode_errors;   // number of invalid characters in nibble-encoded payloads
+    uint16_t framing_errors;  // number of UART framing errors, as reported by MagellanSerial
+    uint16_t overruns;        // number of UART overruns, as reported by MagellanSerial
+    uint16_t device_errors;   // number of error messages sent by the space mouse
+  };
+
   struct axis_bounds_t
   {
     int16_t min;
@@ -89,9 +375,13 @@ namespace magellan_internal
 class MagellanParser
 {
 public:
-  MagellanParser(const magellan_internal::axis_calibration_t *calibration, Print *log = nullptr)
+  /**
+   * @param pipeline turns the raw values into the normalized values, see axis_pipeline_t. must not be nullptr
+   * @param log optional debug output
+   */
+  MagellanParser(const magellan_internal::axis_pipeline_fn pipeline, Print *log = nullptr)
   {
-    this->calibration = calibration;
+    this->pipeline = pipeline;
     this->log = log;
   }
 
@@ -104,6 +394,18 @@ public:
    * check is_ready() to see if the mouse is ready.
    */
   inline void begin(HardwareSerial *serial)
+  {
+    serial->begin(magellan_internal::BAUD_RATE);
+    begin(static_cast<Stream *>(serial));
+  }
+
+  /**
+   * setup the space mouse and initialize
+   * @param serial the serial port to use. must be exclusive to the space mouse, and already set up for BAUD_RATE
+   * @note call in setup()
+   * @note use with MagellanSerial, or to inject data for testing
+   */
+  inline void begin(Stream *serial)
   {
     if (this->log != nullptr)
     {
@@ -111,7 +413,8 @@ public:
     }
 
     this->serial = serial;
-    this->serial->begin(9600);
+    this->begin_millis = millis();
+    this->time_to_ready = 0;
 
     reset();
   }
@@ -126,65 +429,83 @@ public:
       this->log->println(F("[Magellan] reset()"));
     }
 
-    this->init_state = RESET;
+    this->init_state = DETECT;
     this->init_wait_until = 0;
     this->last_reset_millis = 0;
+    this->detect_probe_interval = magellan_internal::DETECT_PROBE_INITIAL_INTERVAL;
+    this->rx_activity = false;
     this->mode = 0;
+    this->adaptive_streak = 0;
 
     this->rx_state = IDLE;
 
-    this->x = 0.0f;
-    this->y = 0.0f;
-    this->z = 0.0f;
-    this->u = 0.0f;
-    this->v = 0.0f;
-    this->w = 0.0f;
+    // drop pending commands
+    this->tx_head = 0;
+    this->tx_tail = 0;
 
-    this->buttons = 0;
+    clear_values();
   }
 
   /**
    * update the state machine, read new data, ...
-   * @return true if values have changed
+   * @return CHANGED_* flags of the values that changed during this call, CHANGED_NONE if nothing changed
    * @note call in loop()
    * @note
    * must be called even when ready() returns false.
    * values are only valid when ready() returns true.
+   * @note
+   * drains up to RX_BYTE_BUDGET bytes from the serial port.
+   * each valid position message updates the raw values as soon as it is complete,
+   * but the values are only normalized once, for the newest one.
+   * see get_merged_frames() for how many were merged this way.
    */
-  bool update();
+  uint8_t update();
+
+  /**
+   * get the number of position messages that were merged (superseded by a newer valid one before being normalized)
+   * during the last call to update()
+   */
+  uint8_t get_merged_frames() const { return merged_frames; }
 
   /**
    * make the space mouse beep
+   * @note does not block, the beeps are sent by update()
    */
   void beep()
   {
     send_command(magellan_internal::COMMAND_BEEP);
-    delay(100);
+    send_pause(magellan_internal::BEEP_PAUSE);
     send_command(magellan_internal::COMMAND_BEEP);
   }
 
+  /**
+   * is the space mouse initialized and the link up?
+   * @note becomes false when the link goes down, until the space mouse is re-configured
+   */
   bool ready() const
   {
-    return init_state == DONE;
+    return init_state == DONE || init_state == PROBE_LINK;
   }
 
-  // normalize values to be in the range [-1.0, 1.0] using the calibration values
-  // also, apply clamping to ensure the range is not exceeded
-  #define SCALE(axis)                                                     \
-    constrain(                                                            \
-      /*positive?*/((this->axis > 0) ?                                    \
-      (this->axis / static_cast<float>(this->calibration->axis.max)) :    \
-      /*negative?*/(this->axis < 0) ?                                     \
-      (this->axis / -(static_cast<float>(this->calibration->axis.min))) : \
-      /*zero*/0.0f),                                                      \
-      /*min*/ -1.0f, /*max*/ 1.0f)
-
-  float get_x() const { return SCALE(x); }
-  float get_y() const { return SCALE(y); }
-  float get_z() const { return SCALE(z); }
-  float get_u() const { return SCALE(u); } // rotation around X
-  float get_v() const { return SCALE(v); } // rotation around Y
-  float get_w() const { return SCALE(w); } // rotation around Z
+  /**
+   * get the timing of the last init sequence
+   */
+  const magellan_internal::init_timing_t &get_init_timing() const { return init_timing; }
+
+  /**
+   * get the time it took from begin() until the init sequence completed the first time
+   * @return time to ready in milliseconds, or 0 if not ready yet
+   */
+  uint32_t get_time_to_ready() const { return time_to_ready; }
+
+  // values normalized to Q15 by the axis pipeline, range Q15_MIN to Q15_MAX.
+  // normalized once per update(), so these are plain loads
+  q15_t get_x_q15() const { return normalized.x; }
+  q15_t get_y_q15() const { return normalized.y; }
+  q15_t get_z_q15() const { return normalized.z; }
+  q15_t get_u_q15() const { return normalized.u; } // rotation around X
+  q15_t get_v_q15() const { return normalized.v; } // rotation around Y
+  q15_t get_w_q15() const { return normalized.w; } // rotation around Z
 
   int16_t get_x_raw() const { return x; }
   int16_t get_y_raw() const { return y; }
@@ -193,6 +514,11 @@ public:
   int16_t get_v_raw() const { return v; }
   int16_t get_w_raw() const { return w; }
 
+  /**
+   * get all raw values, e.g. to map them with axis_pipeline_t::counts()
+   */
+  magellan_internal::axis_values_t<int16_t> get_raw() const { return {x, y, z, u, v, w}; }
+
   uint16_t get_buttons() const { return buttons; }
 
   /**
@@ -208,37 +534,61 @@ public:
     return buttons & (1 << button);
   }
 
+  /**
+   * get the queue of button edges, in the order they were received.
+   * @note
+   * every press and release is queued, even when the button is released again within the same update() call.
+   * the caller is the only consumer, and should pop() all edges after each update() call
+   */
+  ButtonEdgeQueue<magellan_internal::BUTTON_EDGE_QUEUE_SIZE> &get_button_edges() { return button_edges; }
+
   uint8_t get_translation_sensitivity() const { return translation_sensitivity; }
   uint8_t get_rotation_sensitivity() const { return rotation_sensitivity; }
 
   uint8_t get_mode() const { return mode; }
 
+  /**
+   * get the null radius as reported by the space mouse
+   */
+  uint8_t get_null_radius() const { return null_radius; }
+
+  /**
+   * set the null radius of the space mouse.
+   * movements within the null radius are suppressed by the space mouse, reducing traffic while at rest.
+   * @param radius the null radius, 0-15
+   * @note if not yet ready, the null radius is set as part of the init sequence
+   */
+  void set_null_radius(const uint8_t radius);
+
+  /**
+   * get statistics about the quality of the serial link
+   */
+  const magellan_internal::link_stats_t &get_link_stats() const { return link_stats; }
+
 private:
   /**
    * the serial port to use
    */
-  HardwareSerial *serial;
+  Stream *serial;
 
   enum init_state_t
   {
-    RESET,                    // send reset command, wait 100ms
+    DETECT,                   // probe until the space mouse responds, with exponential backoff
+    RESET,                    // wait for the line to go quiet, then send reset command
+    WAIT_RESET,               // wait for the reset to be answered, up to RESET_TIMEOUT
     REQUEST_VERSION,          // send get version command
     WAIT_VERSION,             // wait for version response
-    REQUEST_BUTTON_REPORTING, // send enable button reporting command
-    WAIT_BUTTON_REPORTING,    // wait for button reporting to be enabled
-    REQUEST_SET_MODE,         // send set mode command
-    WAIT_SET_MODE,            // wait for mode to be set
-    REQUEST_SET_SENSITIVITY,  // send set sensitivity command
-    WAIT_SET_SENSITIVITY,     // wait for sensitivity to be set
-    REQUEST_ZERO,             // send zero command
-    WAIT_ZERO,                // wait for zero command to be acknowledged
-    DONE                      // init sequence is complete
+    REQUEST_CONFIG,           // send enable button reporting, set mode, set sensitivity, set null radius and zero commands
+    WAIT_CONFIG,              // wait for all config commands to be acknowledged
+    DONE,                     // init sequence is complete. probe the link when it goes quiet
+    PROBE_LINK,               // probe sent, wait for any message. still ready
+    LINK_DOWN                 // probe was not answered. keep probing, then re-run REQUEST_CONFIG
   };
 
   /**
    * current state of the init sequence state machine
    */
-  init_state_t init_state = RESET;
+  init_state_t init_state = DETECT;
 
   /**
    * wait time before next state advance in init sequence
@@ -250,12 +600,158 @@ private:
    */
   uint32_t last_reset_millis = 0;
 
+  /**
+   * acknowledged init steps. bit mask of init_ack_bit(init_step_t)
+   */
+  uint8_t init_acks = 0;
+
+  /**
+   * time the command of the current init step was sent
+   */
+  uint32_t init_step_millis = 0;
+
+  /**
+   * timing of the last init sequence
+   */
+  magellan_internal::init_timing_t init_timing = {};
+
+  /**
+   * record the acknowledgement of an init step
+   * @param step the acknowledged step
+   * @note only the first acknowledgement of each step is recorded
+   */
+  void ack_init_step(const magellan_internal::init_step_t step);
+
+  /**
+   * was the given init step acknowledged?
+   */
+  inline bool init_acked(const magellan_internal::init_step_t step) const
+  {
+    return (init_acks & init_ack_bit(step)) != 0;
+  }
+
+  /**
+   * complete the init sequence and log its timing
+   */
+  void finish_init(const uint32_t now);
+
+  /**
+   * last time a complete message was received
+   */
+  uint32_t last_rx_millis = 0;
+
+  /**
+   * was any complete message received since the last link probe?
+   */
+  bool probe_answered = false;
+
+  /**
+   * send a probe to check if the space mouse is still there
+   */
+  void send_link_probe(const uint32_t now);
+
+  /**
+   * re-run only the config part of the init sequence
+   */
+  void restart_config(const uint32_t now);
+
+  /**
+   * current interval between probes in DETECT state
+   */
+  uint32_t detect_probe_interval = magellan_internal::DETECT_PROBE_INITIAL_INTERVAL;
+
+  /**
+   * was any byte received since entering DETECT state?
+   */
+  bool rx_activity = false;
+
+  /**
+   * last time any byte was received
+   */
+  uint32_t last_rx_byte_millis = 0;
+
+  /**
+   * did the current version message start after the reset command was completely sent?
+   * @note only such a message answers the reset
+   */
+  bool version_after_reset = false;
+
+  /**
+   * time begin() was called
+   */
+  uint32_t begin_millis = 0;
+
+  /**
+   * time from begin() until the init sequence completed the first time. 0 if not ready yet
+   */
+  uint32_t time_to_ready = 0;
+
   /**
    * mode as reported by the space mouse.
-   * @note expected to be 3 normally.
+   * @note expected to be requested_mode normally.
    */
   uint8_t mode = 0;
 
+  /**
+   * reporting mode requested from the space mouse
+   */
+  uint8_t requested_mode = magellan_internal::MODE_TRANSLATION_ROTATION;
+
+  /**
+   * null radius as reported by the space mouse
+   */
+  uint8_t null_radius = 0;
+
+  /**
+   * null radius requested from the space mouse
+   */
+  uint8_t requested_null_radius = magellan_internal::DEFAULT_NULL_RADIUS;
+
+  /**
+   * send the set null radius command for requested_null_radius
+   */
+  void send_null_radius_command();
+
+  /**
+   * adaptive reporting mode: number of consecutive messages dominated by translation (positive) or rotation (negative)
+   */
+  int8_t adaptive_streak = 0;
+
+  /**
+   * adaptive reporting mode: was a position message processed since the last call to update_adaptive_mode()?
+   */
+  bool adaptive_new_message = false;
+
+  /**
+   * adaptive reporting mode: last time the reporting mode was switched
+   */
+  uint32_t last_mode_switch_millis = 0;
+
+  /**
+   * switch the reporting mode when motion is clearly dominated by translation or rotation
+   * @note does nothing unless ADAPTIVE_REPORTING_MODE is enabled
+   */
+  void update_adaptive_mode();
+
+  /**
+   * set the reporting mode of the space mouse.
+   * @param mode the mode to set. one of MODE_TRANSLATION, MODE_ROTATION or MODE_TRANSLATION_ROTATION
+   * @note
+   * in MODE_TRANSLATION and MODE_ROTATION, the space mouse sends shorter position messages,
+   * so values are updated more often. values of the group not reported read 0
+   * until MODE_TRANSLATION_ROTATION is set again.
+   * @note
+   * private, since only the 24 character layout of MODE_TRANSLATION_ROTATION is documented.
+   * the 12 character layout decoded by process_position_rotation() is not verified on hardware.
+   * only used by update_adaptive_mode()
+   */
+  void set_reporting_mode(const uint8_t mode);
+
+  /**
+   * send the set mode command for requested_mode
+   */
+  void send_mode_command();
+
   /**
    * translation sensitivity level. 0-7
    */
@@ -274,20 +770,23 @@ private:
 private:
   enum rx_state_t
   {
-    IDLE,            // waiting for start of message
-    READ_MESSAGE,    // read message data until MESSAGE_END separator
-    WAIT_MESSAGE_END // wait for MESSAGE_END separator, drop all data
+    IDLE,         // waiting for start of message
+    READ_MESSAGE, // read message data until the expected length or MESSAGE_END separator
+    RESYNC        // lost sync, drop all data until a plausible message type
   };
 
   enum message_type_t : char
   {
-    UNKNOWN = 0,             // unknown message type
-    VERSION = 'v',           // version message
-    KEYPRESS = 'k',          // keypress message
-    POSITION_ROTATION = 'd', // position and rotation message
-    MODE_CHANGE = 'm',       // mode change message
-    ZERO = 'z',              // zeroed message
-    SENSITIVITY_CHANGE = 'q' // sensitivity change message
+    UNKNOWN = 0,              // unknown message type
+    VERSION = 'v',            // version message
+    KEYPRESS = 'k',           // keypress message
+    POSITION_ROTATION = 'd',  // position and rotation message
+    MODE_CHANGE = 'm',        // mode change message
+    ZERO = 'z',               // zeroed message
+    NULL_RADIUS = 'n',        // null radius message
+    SENSITIVITY_CHANGE = 'q', // sensitivity change message
+    BEEP = 'b',               // beep echo. payload is undocumented
+    ERROR = 'e'               // error message, generally a communication error. payload is undocumented
   };
 
   /**
@@ -301,15 +800,93 @@ private:
   message_type_t message_type;
 
   /**
-   * buffer for incoming data
+   * accumulator for the payload of the current message.
+   * characters are folded in as they are received, so no raw message buffer is needed
    */
-  char rx_buffer[magellan_internal::MESSAGE_BUFFER_SIZE];
+  union
+  {
+    // nibble-encoded payloads, 4 nibbles per word. first character is the most significant nibble
+    uint16_t words[magellan_internal::MAX_PAYLOAD_WORDS];
+
+    // start of the version string, null-terminated
+    char version[magellan_internal::VERSION_BUFFER_SIZE];
+  } rx_data;
 
   /**
-   * length of the string in rx_buffer
+   * number of payload characters received for the current message
    */
   uint8_t rx_len = 0;
 
+  /**
+   * expected payload length of the current message, or PAYLOAD_VARIABLE_LENGTH
+   */
+  uint8_t rx_expected_len = 0;
+
+  /**
+   * number of characters of VERSION_MAGIC matched in the current version message
+   */
+  uint8_t version_match = 0;
+
+  /**
+   * fold a payload character into the message accumulator
+   * @param c the character to fold
+   * @return false if the character is not valid for the current message type
+   */
+  bool fold_character(const char c);
+
+  /**
+   * get the expected payload length of a message type
+   * @param type the message type character
+   * @return the payload length, PAYLOAD_VARIABLE_LENGTH or PAYLOAD_UNKNOWN_TYPE
+   */
+  uint8_t payload_length(const char type) const;
+
+  /**
+   * start receiving a new message, if c is a known message type
+   * @param c the message type character
+   * @return true if c is a known message type
+   */
+  bool begin_message(const char c);
+
+  /**
+   * process the current message if the full payload was received
+   * @return true if a message was processed
+   */
+  bool dispatch_if_complete();
+
+  /**
+   * enter the RESYNC state after receiving an unexpected character
+   */
+  void enter_resync();
+
+  /**
+   * handle a line error marker inserted by MagellanSerial
+   * @param marker the marker, one of RX_MARKER_*
+   */
+  void handle_line_error(const uint8_t marker);
+
+  /**
+   * number of position messages merged during the last update() call
+   */
+  uint8_t merged_frames = 0;
+
+  /**
+   * statistics about the quality of the serial link
+   */
+  magellan_internal::link_stats_t link_stats = {};
+
+  /**
+   * were the raw values updated by a position message, but not yet normalized?
+   * @note set by process_position_rotation(), cleared by apply_position()
+   */
+  bool position_pending = false;
+
+  /**
+   * normalize the raw values of the newest position message, if there is one
+   * @note called once per update(), after draining the RX backlog
+   */
+  void apply_position();
+
   /**
    * update RX state machine
    * @param c the character to process
@@ -333,49 +910,142 @@ private:
    * @note each button is represented by a single bit. top 4 bits are unused.
    */
   uint16_t buttons = 0;
+
+  /**
+   * reset translation, rotation and buttons to neutral
+   */
+  inline void clear_values()
+  {
+    this->x = 0;
+    this->y = 0;
+    this->z = 0;
+    this->u = 0;
+    this->v = 0;
+    this->w = 0;
+    normalize_values();
+    this->position_pending = false;
+
+    set_buttons(0);
+  }
+
+  /**
+   * computes the normalized values from the raw values
+   */
+  magellan_internal::axis_pipeline_fn pipeline;
+
+  /**
+   * normalized values, updated by normalize_values()
+   */
+  magellan_internal::axis_values_t<q15_t> normalized = {0, 0, 0, 0, 0, 0};
+
+  /**
+   * update the normalized values from the raw values, using the pipeline
+   * @note call whenever the raw values change
+   */
+  void normalize_values();
+
+  /**
+   * queue of button edges, see get_button_edges()
+   */
+  ButtonEdgeQueue<magellan_internal::BUTTON_EDGE_QUEUE_SIZE> button_edges;
+
+  /**
+   * update the button state, queueing an edge for every button that changed
+   * @param new_buttons the new button state
+   */
+  void set_buttons(const uint16_t new_buttons);
+
   static_assert((sizeof(buttons) * 8) >= magellan_internal::BUTTON_COUNT, "MagellanParser::buttons is too small for given BUTTON_COUNT!");
 
 private:
   /**
-   * send a command to the space mouse
+   * queue for commands sent to the space mouse.
+   * ring buffer, drained by update_tx()
+   */
+  char tx_queue[magellan_internal::TX_QUEUE_SIZE];
+
+  /**
+   * write position in tx_queue
+   */
+  uint8_t tx_head = 0;
+
+  /**
+   * read position in tx_queue
+   */
+  uint8_t tx_tail = 0;
+
+  /**
+   * last time a character was sent, or a pause started
+   */
+  uint32_t tx_last_micros = 0;
+
+  /**
+   * time to wait after tx_last_micros before sending the next character
+   */
+  uint32_t tx_wait_micros = 0;
+
+  /**
+   * send queued characters, paced to compensate for missing flow control
+   * @note does not block
+   */
+  void update_tx();
+
+  /**
+   * add a single character to the TX queue
+   * @return false if the queue is full
+   */
+  bool enqueue_tx(const char c);
+
+  /**
+   * get the number of free characters in the TX queue
+   */
+  inline uint8_t tx_free() const
+  {
+    return magellan_internal::TX_QUEUE_SIZE - 1 - ((tx_head - tx_tail + magellan_internal::TX_QUEUE_SIZE) % magellan_internal::TX_QUEUE_SIZE);
+  }
+
+  /**
+   * queue a command for sending to the space mouse
    * @param command the command to send
+   * @return false if the TX queue is full. the command is dropped in that case
    * @note adding MESSAGE_END is the responsibility of the caller
-   * @note this function may block for a few hundred milliseconds
+   * @note does not block, the command is sent by update()
    */
-  void send_command(const char *command);
+  bool send_command(const char *command);
+
+  /**
+   * queue a pause between two commands
+   * @param duration the pause duration in milliseconds
+   * @return false if the TX queue is full
+   */
+  bool send_pause(const uint8_t duration);
 
   /**
    * process a message received from the space mouse
    * @param type the type of the message
-   * @param payload the message data. does not include the message type
-   * @param len the length of the message data
+   * @param len the length of the message payload. does not include the message type
    * @return were any state values updated?
+   * @note the payload is read from rx_data
    */
-  bool process_message(const message_type_t type, const char *payload, const uint8_t len);
+  bool process_message(const message_type_t type, const uint8_t len);
 
   // functions to process specific message types
-  bool process_version(const char *payload, const uint8_t len);
-  bool process_mode_change(const char *payload, const uint8_t len);
-  bool process_sensitivity_change(const char *payload, const uint8_t len);
-  bool process_zero(const char *payload, const uint8_t len);
-  bool process_keypress(const char *payload, const uint8_t len);
-  bool process_position_rotation(const char *payload, const uint8_t len);
-
-  /**
-   * decode a character into a nibble
-   * @param c the character to decode
-   * @return the decoded nibble
-   */
-  uint8_t decode_nibble(const char c);
+  bool process_version(const uint8_t len);
+  bool process_error(const uint8_t len);
+  bool process_mode_change(const uint8_t len);
+  bool process_sensitivity_change(const uint8_t len);
+  bool process_zero(const uint8_t len);
+  bool process_null_radius(const uint8_t len);
+  bool process_keypress(const uint8_t len);
+  bool process_position_rotation(const uint8_t len);
 
   /**
-   * decode a signed 16-bit word from a buffer of 4 characters
-   * @param buffer the buffer to decode
+   * decode a signed 16-bit word folded from 4 characters
+   * @param word the folded word
    * @return the decoded value
    */
-  int16_t decode_signed_word(const char *buffer);
+  static int16_t decode_signed_word(const uint16_t word);
 
 private:
-  const magellan_internal::axis_calibration_t *calibration;
   Print *log = nullptr;
 };
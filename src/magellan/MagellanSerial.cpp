@@ -0,0 +1,137 @@
+#include "MagellanSerial.hpp"
+
+using namespace magellan_internal;
+
+void MagellanSerial::receive(const uint8_t c, const bool framing_error, const bool overrun)
+{
+  if (overrun)
+  {
+    this->overruns++;
+    this->rx_dropped = true;
+  }
+
+  // mark where bytes were lost, before pushing anything else
+  if (this->rx_dropped)
+  {
+    if (!push(RX_MARKER_OVERRUN))
+    {
+      // still full, drop this byte too
+      return;
+    }
+
+    this->rx_dropped = false;
+  }
+
+  uint8_t data = c;
+  if (framing_error)
+  {
+    // the byte is garbage, replace it with a marker
+    this->framing_errors++;
+    data = RX_MARKER_FRAMING_ERROR;
+  }
+
+  if (!push(data))
+  {
+    // ring buffer full
+    this->overruns++;
+    this->rx_dropped = true;
+  }
+}
+
+#if MAGELLAN_SERIAL_RX_ISR
+
+MagellanSerial MagellanSerial1;
+
+ISR(USART1_RX_vect)
+{
+  // status must be read before UDR1
+  const uint8_t status = UCSR1A;
+  const uint8_t c = UDR1;
+  MagellanSerial1.receive(c, (status & _BV(FE1)) != 0, (status & _BV(DOR1)) != 0);
+}
+
+void MagellanSerial::begin(const uint32_t baud)
+{
+  this->rx_head = 0;
+  this->rx_tail = 0;
+  this->rx_dropped = false;
+  this->tx_written = false;
+
+  // double speed mode, same as HardwareSerial
+  const uint16_t ubrr = (F_CPU / 4 / baud - 1) / 2;
+  UCSR1A = _BV(U2X1);
+  UBRR1H = ubrr >> 8;
+  UBRR1L = ubrr & 0xFF;
+
+  // 8N1, enable RX, TX and RX interrupt
+  UCSR1C = _BV(UCSZ11) | _BV(UCSZ10);
+  UCSR1B = _BV(RXEN1) | _BV(TXEN1) | _BV(RXCIE1);
+}
+
+size_t MagellanSerial::write(const uint8_t c)
+{
+  while ((UCSR1A & _BV(UDRE1)) == 0)
+    ;
+
+  // clear TXC1 (by writing a 1), so flush() can wait for it
+  UCSR1A = (UCSR1A & (_BV(U2X1) | _BV(MPCM1))) | _BV(TXC1);
+  UDR1 = c;
+  this->tx_written = true;
+  return 1;
+}
+
+int MagellanSerial::availableForWrite()
+{
+  return (UCSR1A & _BV(UDRE1)) != 0 ? 1 : 0;
+}
+
+void MagellanSerial::flush()
+{
+  if (!this->tx_written)
+  {
+    return;
+  }
+
+  while ((UCSR1A & _BV(TXC1)) == 0)
+    ;
+}
+
+#else
+
+// without MAGELLAN_SERIAL_RX_ISR, there is no hardware attached.
+// bytes can only be injected using receive(), and writes go to the tx sink (or are discarded)
+
+void MagellanSerial::begin(const uint32_t baud)
+{
+  (void)baud;
+  this->rx_head = 0;
+  this->rx_tail = 0;
+  this->rx_dropped = false;
+}
+
+size_t MagellanSerial::write(const uint8_t c)
+{
+  if (this->tx_sink == nullptr)
+  {
+    // discarded, but accepted so the writer keeps draining
+    return 1;
+  }
+
+  return this->tx_sink->write(c);
+}
+
+int MagellanSerial::availableForWrite()
+{
+  // the sink is a plain Print, so it always takes the next byte
+  return 1;
+}
+
+void MagellanSerial::flush()
+{
+  if (this->tx_sink != nullptr)
+  {
+    this->tx_sink->flush();
+  }
+}
+
+#endif
@@ -0,0 +1,167 @@
+#pragma once
+#include <Arduino.h>
+
+// how the serial link to the Magellan is received
+// 0: use HardwareSerial (Serial1), polled by MagellanParser
+// 1: use MagellanSerial1, an interrupt-driven RX ring buffer owned by the Magellan subsystem.
+//    Serial1 must not be used anywhere else, since both define USART1_RX_vect
+#define MAGELLAN_SERIAL_RX_ISR 0
+
+// size of the MagellanSerial RX ring buffer. must be a power of two, at most 128
+#define MAGELLAN_SERIAL_RX_RING_SIZE 64
+
+namespace magellan_internal
+{
+  /**
+   * marker inserted into the RX stream in place of a byte received with a framing error
+   * @note the Magellan only sends 7-bit ASCII, so markers cannot collide with real data
+   */
+  constexpr uint8_t RX_MARKER_FRAMING_ERROR = 0xF0;
+
+  /**
+   * marker inserted into the RX stream where bytes were lost, either by a hardware data overrun or a full ring buffer
+   */
+  constexpr uint8_t RX_MARKER_OVERRUN = 0xF1;
+
+  static_assert((MAGELLAN_SERIAL_RX_RING_SIZE & (MAGELLAN_SERIAL_RX_RING_SIZE - 1)) == 0, "MAGELLAN_SERIAL_RX_RING_SIZE must be a power of two!");
+  static_assert(MAGELLAN_SERIAL_RX_RING_SIZE <= 128, "MAGELLAN_SERIAL_RX_RING_SIZE must be at most 128!");
+}
+
+/**
+ * interrupt-driven serial port for the Magellan link, using USART1.
+ *
+ * @note
+ * received bytes are pushed into a ring buffer by the USART1_RX_vect ISR using receive().
+ * line errors (framing errors and overruns) are reported in-band using RX_MARKER_* bytes,
+ * so the parser knows exactly which message was affected.
+ *
+ * @note
+ * receive() can also be called directly to inject bytes, e.g. for testing on the host.
+ * without MAGELLAN_SERIAL_RX_ISR, written bytes go to the sink set by set_tx_sink()
+ */
+class MagellanSerial : public Stream
+{
+public:
+  /**
+   * setup USART1 for 8N1 at the given baud rate and enable the RX interrupt
+   * @param baud the baud rate
+   * @note without MAGELLAN_SERIAL_RX_ISR, there is no hardware. only the ring buffer is reset, and baud is ignored
+   */
+  void begin(const uint32_t baud);
+
+  /**
+   * push a received byte into the ring buffer
+   * @param c the received byte
+   * @param framing_error was the byte received with a framing error?
+   * @param overrun were bytes lost before this one (hardware data overrun)?
+   * @note called from the RX ISR
+   */
+  void receive(const uint8_t c, const bool framing_error, const bool overrun);
+
+  int available() override
+  {
+    return static_cast<uint8_t>(rx_head - rx_tail) & (MAGELLAN_SERIAL_RX_RING_SIZE - 1);
+  }
+
+  int peek() override
+  {
+    if (rx_head == rx_tail)
+    {
+      return -1;
+    }
+
+    return rx_buffer[rx_tail];
+  }
+
+  int read() override
+  {
+    if (rx_head == rx_tail)
+    {
+      return -1;
+    }
+
+    const uint8_t c = rx_buffer[rx_tail];
+    rx_tail = (rx_tail + 1) & (MAGELLAN_SERIAL_RX_RING_SIZE - 1);
+    return c;
+  }
+
+  size_t write(const uint8_t c) override;
+  int availableForWrite() override;
+  void flush() override;
+
+  using Print::write;
+
+  /**
+   * number of bytes received with a framing error
+   */
+  uint16_t get_framing_errors() const { return framing_errors; }
+
+  /**
+   * number of times bytes were lost, by hardware data overrun or a full ring buffer
+   */
+  uint16_t get_overruns() const { return overruns; }
+
+#if !MAGELLAN_SERIAL_RX_ISR
+  /**
+   * set where written bytes go, e.g. to capture them for testing on the host
+   * @param sink the sink. nullptr discards written bytes
+   * @note only available when MAGELLAN_SERIAL_RX_ISR is disabled
+   */
+  void set_tx_sink(Print *sink) { tx_sink = sink; }
+#endif
+
+private:
+  uint8_t rx_buffer[MAGELLAN_SERIAL_RX_RING_SIZE];
+
+  /**
+   * write position, only modified by receive()
+   */
+  volatile uint8_t rx_head = 0;
+
+  /**
+   * read position, only modified by read()
+   */
+  volatile uint8_t rx_tail = 0;
+
+  /**
+   * were bytes dropped because the ring buffer was full?
+   * @note the overrun marker is inserted as soon as there is space again
+   */
+  bool rx_dropped = false;
+
+  /**
+   * was any byte written since begin()? used by flush()
+   */
+  bool tx_written = false;
+
+  volatile uint16_t framing_errors = 0;
+  volatile uint16_t overruns = 0;
+
+#if !MAGELLAN_SERIAL_RX_ISR
+  /**
+   * sink for written bytes, see set_tx_sink()
+   */
+  Print *tx_sink = nullptr;
+#endif
+
+  /**
+   * push a single byte into the ring buffer
+   * @return false if the ring buffer is full
+   */
+  inline bool push(const uint8_t c)
+  {
+    const uint8_t next = (rx_head + 1) & (MAGELLAN_SERIAL_RX_RING_SIZE - 1);
+    if (next == rx_tail)
+    {
+      return false;
+    }
+
+    rx_buffer[rx_head] = c;
+    rx_head = next;
+    return true;
+  }
+};
+
+#if MAGELLAN_SERIAL_RX_ISR
+extern MagellanSerial MagellanSerial1;
+#endif
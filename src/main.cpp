@@ -13,7 +13,7 @@
 #define CALIBRATION 0     // enable calibration mode. normal usage is disabled when calibration is enabled
 
 // magellan axis calibration values, as reported by CalibrationUtil
-static const magellan_internal::axis_calibration_t cal = {
+static constexpr magellan_internal::axis_calibration_t cal = {
     .x = {-3775, 2173},
     .y = {-3900, 4037},
     .z = {-1682, 3122},
@@ -22,22 +22,33 @@ static const magellan_internal::axis_calibration_t cal = {
     .w = {-3839, 1691},
 };
 
-// correction factors applied to the values received from the Magellan
-// before being sent to the HIDSpaceMouse.
-// 1.0f means no correction, -1.0f means invert the value.
-// these values be in the range [-1.0f, 1.0f]
-constexpr float x_correction = 1.0f;  // x position
-constexpr float y_correction = 1.0f;  // y position
-constexpr float z_correction = -1.0f; // z position
-constexpr float u_correction = 1.0f;  // rotation around x axis
-constexpr float v_correction = 1.0f;  // rotation around y axis
-constexpr float w_correction = -1.0f; // rotation around z axis
+// how the values received from the Magellan are mapped to the HIDSpaceMouse axes.
+// for each output axis: source axis, calibration, sign (1 or -1) and optionally a scale in Q15.
+// evaluated at compile time, invalid configurations fail to compile
+typedef magellan_internal::axis_pipeline_t<
+    magellan_internal::axis_map_t<magellan_internal::AXIS_X, cal.x.min, cal.x.max, 1>,  // x position
+    magellan_internal::axis_map_t<magellan_internal::AXIS_Y, cal.y.min, cal.y.max, 1>,  // y position
+    magellan_internal::axis_map_t<magellan_internal::AXIS_Z, cal.z.min, cal.z.max, -1>, // z position
+    magellan_internal::axis_map_t<magellan_internal::AXIS_U, cal.u.min, cal.u.max, 1>,  // rotation around x axis
+    magellan_internal::axis_map_t<magellan_internal::AXIS_V, cal.v.min, cal.v.max, 1>,  // rotation around y axis
+    magellan_internal::axis_map_t<magellan_internal::AXIS_W, cal.w.min, cal.w.max, -1>  // rotation around z axis
+    >
+    axis_pipeline;
+
+// null radius of the Magellan, 0-15.
+// movements within this radius are suppressed by the Magellan itself,
+// so it does not keep sending data while at rest
+constexpr uint8_t null_radius = magellan_internal::DEFAULT_NULL_RADIUS;
+
+// how often to print the HID data age and button latency statistics, with DEBUG >= 1
+constexpr uint32_t DATA_AGE_PRINT_INTERVAL = 10000; // ms
 
 // how long to wait for a double press of the "*" button
 constexpr uint32_t STAR_BUTTON_DOUBLE_PRESS_TIMEOUT = 500; // ms
 
-// mapping of Magellan buttons to HIDSpaceMouse buttons
-static const HIDSpaceMouse::KnownButton button_mappings[magellan_internal::BUTTON_COUNT] = {
+// mapping of Magellan buttons to HIDSpaceMouse buttons.
+// a permutation, so every button edge is forwarded with a single lookup
+static constexpr HIDSpaceMouse::KnownButton button_mappings[magellan_internal::BUTTON_COUNT] = {
     HIDSpaceMouse::ONE,     // Key "1"
     HIDSpaceMouse::TWO,     // Key "2"
     HIDSpaceMouse::THREE,   // Key "3"
@@ -49,6 +60,8 @@ static const HIDSpaceMouse::KnownButton button_mappings[magellan_internal::BUTTO
     HIDSpaceMouse::MENU     // Key "*" (double press)
 };
 
+static_assert(HIDSpaceMouse::buttons_unique(button_mappings, magellan_internal::BUTTON_COUNT), "button_mappings must map every Magellan button to a different HIDSpaceMouse button!");
+
 #if DEBUG >= 2
 HIDSpaceMouse spaceMouse(&Serial); // debug output to USB serial port
 #else
@@ -56,35 +69,24 @@ HIDSpaceMouse spaceMouse; // no debug output
 #endif
 
 #if DEBUG >= 3
-MagellanParser magellan(&cal, &Serial); // debug output to USB serial port
+MagellanParser magellan(&axis_pipeline::apply, &Serial); // debug output to USB serial port
 #else
-MagellanParser magellan(&cal); // no debug output
+MagellanParser magellan(&axis_pipeline::apply); // no debug output
 #endif
 
 #if CALIBRATION == 1
 MagellanCalibrationUtil calibration(&Serial, &magellan);
 #endif
 
-void handle_buttons(const bool from_event)
-{
-  constexpr uint8_t STAR_BUTTON_ID = 8;
-
-  // update button states according to mapping
-  // only when called from a button event (a button actually changed)
-  if (from_event)
-  {
-    for (uint8_t i = 0; i < magellan_internal::BUTTON_COUNT; i++)
-    {
-      // skip the "*" button, it's handled separately below
-      if (i == STAR_BUTTON_ID)
-      {
-        continue;
-      }
-
-      spaceMouse.set_button(button_mappings[i], magellan.get_button(i));
-    }
-  }
+constexpr uint8_t STAR_BUTTON_ID = 8;
 
+/**
+ * handle the "*" button, which is only sent to the host when double pressed
+ * @param pressed the current state of the "*" button
+ * @param now the time of the state, in millis
+ */
+void handle_star_button(const bool pressed, const uint32_t now)
+{
   // check if the "*" button is pressed, then released, and then pressed again within 500ms
   // runs always, as it needs to handle the timing of the button presses
   // thus, the button state needs to be handled manually
@@ -99,7 +101,6 @@ void handle_buttons(const bool from_event)
   static StarButtonState star_button_state = Idle;
   static uint32_t star_first_release_millis = 0;
 
-  const uint32_t now = millis();
 #if DEBUG >= 1
   const StarButtonState old_state = star_button_state;
 #endif
@@ -108,7 +109,7 @@ void handle_buttons(const bool from_event)
   {
   case Idle:
   {
-    if (magellan.get_button(STAR_BUTTON_ID))
+    if (pressed)
     {
       star_button_state = FirstDown;
     }
@@ -116,7 +117,7 @@ void handle_buttons(const bool from_event)
   }
   case FirstDown:
   {
-    if (!magellan.get_button(STAR_BUTTON_ID))
+    if (!pressed)
     {
       star_button_state = FirstRelease;
       star_first_release_millis = now;
@@ -125,7 +126,7 @@ void handle_buttons(const bool from_event)
   }
   case FirstRelease:
   {
-    if (magellan.get_button(STAR_BUTTON_ID))
+    if (pressed)
     {
       // button was pressed a second time
       spaceMouse.set_button(button_mappings[STAR_BUTTON_ID], true);
@@ -140,7 +141,7 @@ void handle_buttons(const bool from_event)
   }
   case SecondDown:
   {
-    if (!magellan.get_button(STAR_BUTTON_ID))
+    if (!pressed)
     {
       // button was released
       spaceMouse.set_button(button_mappings[STAR_BUTTON_ID], false);
@@ -166,9 +167,31 @@ void handle_buttons(const bool from_event)
 #endif
 }
 
+/**
+ * map a button edge from the Magellan to the HIDSpaceMouse
+ * @param edge the edge to handle
+ */
+void handle_button_edge(const button_edge_t &edge)
+{
+  // the "*" button is handled separately
+  if (edge.button == STAR_BUTTON_ID)
+  {
+    handle_star_button(edge.pressed, edge.timestamp);
+    return;
+  }
+
+  spaceMouse.set_button(button_mappings[edge.button], edge.pressed);
+}
+
 void setup()
 {
+  magellan.set_null_radius(null_radius);
+#if MAGELLAN_SERIAL_RX_ISR
+  MagellanSerial1.begin(magellan_internal::BAUD_RATE);
+  magellan.begin(&MagellanSerial1);
+#else
   magellan.begin(&Serial1);
+#endif
 
   // note: Serial is the USB serial port, Serial1 is the hardware serial port
   Serial.begin(115200);
@@ -177,9 +200,6 @@ void setup()
   // wait for host to open serial port
   while (!Serial)
     ;
-#else
-  // FIXME magellan hangs if we don't wait a bit here
-  delay(2500);
 #endif
 
   Serial.println("[Main] running version \"" GIT_VERSION_STRING "\" @ debug level " STRINGIFY(DEBUG));
@@ -187,64 +207,72 @@ void setup()
 
 void loop()
 {
-  const bool did_update = magellan.update();
+  const uint8_t changed = magellan.update();
 
 #if CALIBRATION == 1
   calibration.update();
   return; // don't use any of the data when in calibration mode
 #endif
 
-  if (did_update)
+  if (changed != magellan_internal::CHANGED_NONE)
   {
     const bool is_ready = magellan.ready();
-    static bool was_ready = false;
-    if (is_ready && !was_ready)
+    const bool ready_changed = (changed & magellan_internal::CHANGED_READY) != 0;
+    if (ready_changed && is_ready)
     {
       // just became ready
       magellan.beep();
 #if DEBUG >= 1
-      Serial.println("[Main] magellan is now ready");
+      Serial.print("[Main] magellan is now ready, time to ready: ");
+      Serial.print(magellan.get_time_to_ready());
+      Serial.print(" ms after begin(), ");
+      Serial.print(millis());
+      Serial.println(" ms after boot");
 #endif
     }
-    else if (!is_ready && was_ready)
+    else if (ready_changed && !is_ready)
     {
+      // no longer ready, e.g. the link to the magellan was lost.
+      // send a neutral state, so the host does not keep moving
+      spaceMouse.set_neutral();
 #if DEBUG >= 1
-      // no longer ready ?!
       Serial.println("[Main] magellan is no longer ready");
 #endif
     }
-    was_ready = is_ready;
 
     if (is_ready)
     {
-      // update rotation and translation values
-      spaceMouse.set_translation(
-          magellan.get_x() * x_correction,
-          magellan.get_y() * y_correction,
-          magellan.get_z() * z_correction);
-      spaceMouse.set_rotation(
-          magellan.get_u() * u_correction,
-          magellan.get_v() * v_correction,
-          magellan.get_w() * w_correction);
-
-      // update button states
-      handle_buttons(true);
+      // map the raw values straight to HID counts, truncated the same way the float path did
+      magellan_internal::axis_values_t<int16_t> counts;
+      axis_pipeline::counts<hid_space_mouse_internal::POSITION_RANGE[1], hid_space_mouse_internal::ROTATION_RANGE[1]>(magellan.get_raw(), counts);
+
+      // only update what actually changed.
+      // after becoming ready, everything has to be sent once
+      if (ready_changed || (changed & magellan_internal::CHANGED_TRANSLATION) != 0)
+      {
+        spaceMouse.set_translation_counts(counts.x, counts.y, counts.z);
+      }
+
+      if (ready_changed || (changed & magellan_internal::CHANGED_ROTATION) != 0)
+      {
+        spaceMouse.set_rotation_counts(counts.u, counts.v, counts.w);
+      }
     }
 
 #if DEBUG >= 1
     // print to console even when not ready
     Serial.print("[Main]: x=");
-    Serial.print(magellan.get_x());
+    Serial.print(magellan.get_x_q15());
     Serial.print(", y=");
-    Serial.print(magellan.get_y());
+    Serial.print(magellan.get_y_q15());
     Serial.print(", z=");
-    Serial.print(magellan.get_z());
+    Serial.print(magellan.get_z_q15());
     Serial.print(", u=");
-    Serial.print(magellan.get_u());
+    Serial.print(magellan.get_u_q15());
     Serial.print(", v=");
-    Serial.print(magellan.get_v());
+    Serial.print(magellan.get_v_q15());
     Serial.print(", w=");
-    Serial.print(magellan.get_w());
+    Serial.print(magellan.get_w_q15());
     Serial.print(", buttons=");
     Serial.print(magellan.get_buttons(), BIN);
     Serial.print(", T-Gain=");
@@ -259,7 +287,16 @@ void loop()
 #endif
   }
 
-  handle_buttons(false);
+  // forward every button edge in order, so short presses are not lost.
+  // edges are forwarded even when not ready, so the released state after losing the link is consistent
+  button_edge_t edge;
+  while (magellan.get_button_edges().pop(edge))
+  {
+    handle_button_edge(edge);
+  }
+
+  // the "*" button double press timeout has to be checked even when no button changed
+  handle_star_button(magellan.get_button(STAR_BUTTON_ID), millis());
 
   spaceMouse.update();
 
@@ -272,4 +309,22 @@ void loop()
 #endif
     old_led = spaceMouse.get_led();
   }
+
+#if DEBUG >= 1
+  // periodically print how old the data was when it was sent to the host
+  static uint32_t last_data_age_millis = 0;
+  if ((millis() - last_data_age_millis) >= DATA_AGE_PRINT_INTERVAL)
+  {
+    last_data_age_millis = millis();
+    const hid_space_mouse_internal::age_histogram_t &age = spaceMouse.get_data_age();
+    Serial.print(F("[Main] HID data age: p50 <= "));
+    Serial.print(age.percentile(50));
+    Serial.print(F(" ms, p99 <= "));
+    Serial.print(age.percentile(99));
+    Serial.print(F(" ms, button latency: p99 <= "));
+    Serial.print(spaceMouse.get_button_latency().percentile(99));
+    Serial.println(F(" ms"));
+    spaceMouse.reset_data_age();
+  }
+#endif
 }
@@ -3,32 +3,105 @@
 using namespace hid_space_mouse_internal;
 
 /**
- * map a normalised float value to a 16-bit integer
- * @param value the normalised float value, range -1.0 to 1.0
+ * map a Q15 value to a 16-bit integer
+ * @param value the Q15 value, range Q15_MIN to Q15_MAX
  * @param range the range of the 16-bit integer
- * @return the mapped 16-bit integer
+ * @return the mapped 16-bit integer, rounded to nearest
  */
-inline int16_t map_normal_float(const float value, const int16_t range[2])
+inline int16_t map_q15(const q15_t value, const int16_t range[2])
 {
-  const int16_t span = range[1] - range[0];
-  return range[0] + (value + 1.0f) * span / 2;
+  const int16_t half_span = (range[1] - range[0]) / 2;
+  const int16_t center = range[0] + half_span;
+  return center + q15_multiply(value, half_span);
 }
 
+/**
+ * apply the noise gate and hysteresis of the quantizer
+ * @param value the quantized value, in HID counts
+ * @param sent the value the host has, in HID counts
+ * @return the value to send to the host
+ * @note rest is 0, since both ranges are symmetric
+ */
+inline int16_t gate_counts(const int16_t value, const int16_t sent)
+{
+  if (value >= -QUANTIZER_NOISE_GATE && value <= QUANTIZER_NOISE_GATE)
+  {
+    return 0;
+  }
+
+  const int16_t delta = value - sent;
+  if (delta >= -QUANTIZER_HYSTERESIS && delta <= QUANTIZER_HYSTERESIS)
+  {
+    return sent;
+  }
+
+  return value;
+}
+
+/**
+ * update the value of an axis, and encode it into its report if it changed
+ * @param value the axis value, in HID counts
+ * @param counts the new value, in HID counts
+ * @param data the axis in the report, little-endian
+ */
+inline void update_axis(int16_t &value, const int16_t counts, uint8_t *data)
+{
+  if (value == counts)
+  {
+    return;
+  }
+
+  value = counts;
+  data[0] = static_cast<uint8_t>(counts & 0xFF);
+  data[1] = static_cast<uint8_t>(counts >> 8);
+}
+
+/**
+ * encode a button bitmask into a button report
+ * @param data the buttons in the report
+ * @param buttons the bitmask, bit i is button i
+ */
+inline void encode_buttons(uint8_t *data, const uint32_t buttons)
+{
+  for (uint8_t i = 0; i < BUTTON_REPORT_SIZE; i++)
+  {
+    data[i] = static_cast<uint8_t>(buttons >> (i * 8));
+  }
+}
+
+static_assert(POSITION_RANGE[0] == -POSITION_RANGE[1], "POSITION_RANGE must be symmetric around 0!");
+static_assert(ROTATION_RANGE[0] == -ROTATION_RANGE[1], "ROTATION_RANGE must be symmetric around 0!");
+static_assert(POSITION_RANGE[1] == ROTATION_RANGE[1], "the quantizer noise gate is scaled from POSITION_RANGE, so ROTATION_RANGE must match it!");
+
 HIDSpaceMouse::HIDSpaceMouse(Print *log) : PluggableUSBModule(2, 1, endpointTypes)
 {
   PluggableUSB().plug(this);
 
   // ensure state is cleared
-  this->state.x = 0.0f;
-  this->state.y = 0.0f;
-  this->state.z = 0.0f;
-  this->state.u = 0.0f;
-  this->state.v = 0.0f;
-  this->state.w = 0.0f;
-  memset(this->state.buttons, false, sizeof(this->state.buttons));
+  this->state.x = map_q15(0, POSITION_RANGE);
+  this->state.y = map_q15(0, POSITION_RANGE);
+  this->state.z = map_q15(0, POSITION_RANGE);
+  this->state.u = map_q15(0, ROTATION_RANGE);
+  this->state.v = map_q15(0, ROTATION_RANGE);
+  this->state.w = map_q15(0, ROTATION_RANGE);
+  this->state.buttons = 0;
 
   // ensure last state is cleared
-  commit_state();
+  memcpy(&this->submit_state, &this->state, sizeof(mouse_state_t));
+
+  // encode the cleared state. rest is 0 counts, so all axes and buttons are zero bytes
+  memset(&this->reports, 0, sizeof(this->reports));
+#if HID_SPACE_MOUSE_COMBINED_REPORT
+  this->reports.motion[0] = MOTION_REPORT_ID;
+#else
+  this->reports.translation[0] = TRANSLATION_REPORT_ID;
+  this->reports.rotation[0] = ROTATION_REPORT_ID;
+#endif
+  this->reports.buttons[0] = BUTTON_REPORT_ID;
+  memcpy(this->submit_button_report, this->reports.buttons, sizeof(this->submit_button_report));
+
+  memset(&this->data_age, 0, sizeof(this->data_age));
+  memset(&this->button_latency, 0, sizeof(this->button_latency));
 
   // setup logging output
   this->log = log;
@@ -69,7 +142,7 @@ int HIDSpaceMouse::getDescriptor(USBSetup& setup)
     return 0;
   }
 
-  // protocol = HID_REPORT_PROTOCOL;
+  this->protocol = HID_REPORT_PROTOCOL;
 
   return USB_SendControl(TRANSFER_PGM, SPACE_MOUSE_REPORT_DESCRIPTOR, sizeof(SPACE_MOUSE_REPORT_DESCRIPTOR));
 }
@@ -85,10 +158,28 @@ bool HIDSpaceMouse::setup(USBSetup& setup)
   {
     if (setup.bRequest == HID_GET_REPORT)
     {
+      // report type in wValueH, report ID in wValueL. only input reports can be read
+      size_t len = 0;
+      const uint8_t *report = setup.wValueH == HID_REPORT_TYPE_INPUT ? get_cached_report(setup.wValueL, len) : nullptr;
+      if (report == nullptr)
+      {
+        return false;
+      }
+
+      USB_SendControl(0, report, len < setup.wLength ? len : setup.wLength);
       return true;
     }
     if (setup.bRequest == HID_GET_PROTOCOL)
     {
+      USB_SendControl(0, &this->protocol, 1);
+      return true;
+    }
+    if (setup.bRequest == HID_GET_IDLE)
+    {
+      // report ID 0 asks for the rate of all reports, they are all the same unless set individually
+      const uint8_t report_id = setup.wValueL;
+      const uint8_t rate = report_id <= INPUT_REPORT_COUNT ? this->idle_rates[report_id == 0 ? 0 : report_id - 1] : 0;
+      USB_SendControl(0, &rate, 1);
       return true;
     }
   }
@@ -97,12 +188,30 @@ bool HIDSpaceMouse::setup(USBSetup& setup)
   {
     if (setup.bRequest == HID_SET_PROTOCOL)
     {
-      // protocol = setup.wValueL;
+      this->protocol = setup.wValueL;
       return true;
     }
     if (setup.bRequest == HID_SET_IDLE)
     {
-      // idle = setup.wValueL;
+      // rate in wValueH, report ID in wValueL. report ID 0 sets the rate of all reports
+      const uint8_t rate = setup.wValueH;
+      const uint8_t report_id = setup.wValueL;
+      if (report_id == 0)
+      {
+        memset(this->idle_rates, rate, sizeof(this->idle_rates));
+      }
+      else if (report_id <= INPUT_REPORT_COUNT)
+      {
+        this->idle_rates[report_id - 1] = rate;
+      }
+
+      if (this->log != nullptr)
+      {
+        this->log->print(F("[SpaceMouse] got HID_SET_IDLE: report="));
+        this->log->print(report_id);
+        this->log->print(F(" rate="));
+        this->log->println(rate);
+      }
       return true;
     }
     if (setup.bRequest == HID_SET_REPORT)
@@ -136,83 +245,259 @@ bool HIDSpaceMouse::setup(USBSetup& setup)
   return false;
 }
 
-int HIDSpaceMouse::send_report(const uint8_t id, const uint8_t *data, const size_t len)
+int HIDSpaceMouse::send_report(const uint8_t *report, const size_t len)
+{
+  // restart the idle period of the report
+  this->report_millis[report[0] - 1] = millis();
+
+  return USB_Send(endpoint_tx() | TRANSFER_RELEASE, report, len);
+}
+
+void HIDSpaceMouse::set_translation(const q15_t x, const q15_t y, const q15_t z)
+{
+  ENSURE_BOUNDS(x, Q15_MIN, Q15_MAX);
+  ENSURE_BOUNDS(y, Q15_MIN, Q15_MAX);
+  ENSURE_BOUNDS(z, Q15_MIN, Q15_MAX);
+
+  set_translation_counts(map_q15(x, POSITION_RANGE), map_q15(y, POSITION_RANGE), map_q15(z, POSITION_RANGE));
+}
+
+void HIDSpaceMouse::set_translation_counts(const int16_t x, const int16_t y, const int16_t z)
+{
+  ENSURE_BOUNDS(x, POSITION_RANGE[0], POSITION_RANGE[1]);
+  ENSURE_BOUNDS(y, POSITION_RANGE[0], POSITION_RANGE[1]);
+  ENSURE_BOUNDS(z, POSITION_RANGE[0], POSITION_RANGE[1]);
+
+  uint8_t *data = translation_data();
+  update_axis(this->state.x, gate_counts(x, this->submit_state.x), &data[0]);
+  update_axis(this->state.y, gate_counts(y, this->submit_state.y), &data[2]);
+  update_axis(this->state.z, gate_counts(z, this->submit_state.z), &data[4]);
+  this->translation_millis = millis();
+
+  // only dirty if the encoded values differ from what the host has.
+  // small changes that quantize to the same counts, or that are within the gate, are dropped here
+  if (this->state.x != this->submit_state.x
+      || this->state.y != this->submit_state.y
+      || this->state.z != this->submit_state.z)
+  {
+    this->dirty_reports |= DIRTY_TRANSLATION;
+  }
+  else
+  {
+    this->dirty_reports &= ~DIRTY_TRANSLATION;
+  }
+}
+
+void HIDSpaceMouse::set_rotation(const q15_t u, const q15_t v, const q15_t w)
+{
+  ENSURE_BOUNDS(u, Q15_MIN, Q15_MAX);
+  ENSURE_BOUNDS(v, Q15_MIN, Q15_MAX);
+  ENSURE_BOUNDS(w, Q15_MIN, Q15_MAX);
+
+  set_rotation_counts(map_q15(u, ROTATION_RANGE), map_q15(v, ROTATION_RANGE), map_q15(w, ROTATION_RANGE));
+}
+
+void HIDSpaceMouse::set_rotation_counts(const int16_t u, const int16_t v, const int16_t w)
+{
+  ENSURE_BOUNDS(u, ROTATION_RANGE[0], ROTATION_RANGE[1]);
+  ENSURE_BOUNDS(v, ROTATION_RANGE[0], ROTATION_RANGE[1]);
+  ENSURE_BOUNDS(w, ROTATION_RANGE[0], ROTATION_RANGE[1]);
+
+  uint8_t *data = rotation_data();
+  update_axis(this->state.u, gate_counts(u, this->submit_state.u), &data[0]);
+  update_axis(this->state.v, gate_counts(v, this->submit_state.v), &data[2]);
+  update_axis(this->state.w, gate_counts(w, this->submit_state.w), &data[4]);
+  this->rotation_millis = millis();
+
+  if (this->state.u != this->submit_state.u
+      || this->state.v != this->submit_state.v
+      || this->state.w != this->submit_state.w)
+  {
+    this->dirty_reports |= DIRTY_ROTATION;
+  }
+  else
+  {
+    this->dirty_reports &= ~DIRTY_ROTATION;
+  }
+}
+
+HIDSpaceMouse::hid_state_t HIDSpaceMouse::next_dirty_state() const
 {
-  auto ret1 = USB_Send(endpoint_tx(), &id, 1);
-  if (ret1 < 0)
+  // buttons first, so a press is not delayed by continuous motion.
+  // motion follows in the next slot, with the latest values
+  if ((this->dirty_reports & DIRTY_BUTTONS) != 0)
   {
-    return ret1;
+    return SEND_BUTTONS;
   }
 
-  auto ret2 = USB_Send(endpoint_tx() | TRANSFER_RELEASE, data, len);
-  if (ret2 < 0)
+#if HID_SPACE_MOUSE_COMBINED_REPORT
+  if ((this->dirty_reports & (DIRTY_TRANSLATION | DIRTY_ROTATION)) != 0)
   {
-    return ret2;
+    return SEND_MOTION;
   }
+#else
+  if ((this->dirty_reports & DIRTY_TRANSLATION) != 0)
+  {
+    return SEND_TRANSLATION;
+  }
+  if ((this->dirty_reports & DIRTY_ROTATION) != 0)
+  {
+    return SEND_ROTATION;
+  }
+#endif
 
-  return ret1 + ret2;
+  return IDLE;
 }
 
 void HIDSpaceMouse::update()
 {
   get_led_state();
 
+  // repeat unchanged reports at the idle rate requested by the host
+  const uint32_t now = millis();
+#if HID_SPACE_MOUSE_COMBINED_REPORT
+  if (idle_elapsed(MOTION_REPORT_ID, now))
+  {
+    this->dirty_reports |= DIRTY_TRANSLATION | DIRTY_ROTATION;
+  }
+#else
+  if (idle_elapsed(TRANSLATION_REPORT_ID, now))
+  {
+    this->dirty_reports |= DIRTY_TRANSLATION;
+  }
+  if (idle_elapsed(ROTATION_REPORT_ID, now))
+  {
+    this->dirty_reports |= DIRTY_ROTATION;
+  }
+#endif
+  if (idle_elapsed(BUTTON_REPORT_ID, now))
+  {
+    this->dirty_reports |= DIRTY_BUTTONS;
+  }
+
+  // pick the report when the slot is free, not before.
+  // so every report is encoded from the latest state, and values that changed back are not sent at all
+  if (this->dirty_reports == 0)
+  {
+    this->hid_state = IDLE;
+    return;
+  }
+
+  if (!can_send_next_report())
+  {
+    return;
+  }
+
+  this->hid_state = next_dirty_state();
   switch(this->hid_state)
   {
-    case IDLE:
+#if !HID_SPACE_MOUSE_COMBINED_REPORT
+    case SEND_TRANSLATION:
     {
-      if (state_dirty())
+      // idle repeats carry no new data, so they do not count towards the data age
+      const bool changed = this->state.x != this->submit_state.x
+                           || this->state.y != this->submit_state.y
+                           || this->state.z != this->submit_state.z;
+      submit_translation();
+      this->submit_state.x = this->state.x;
+      this->submit_state.y = this->state.y;
+      this->submit_state.z = this->state.z;
+      this->dirty_reports &= ~DIRTY_TRANSLATION;
+      if (changed)
       {
-        commit_state();
-        this->hid_state = SEND_TRANSLATION;
-
-        if (this->log != nullptr)
-        {
-          this->log->println(F("[SpaceMouse] mouse state updated, entering SEND_TRANSLATION"));
-        }
+        this->data_age.add(now - this->translation_millis);
       }
-
       break;
     }
-    case SEND_TRANSLATION:
+    case SEND_ROTATION:
     {
-      if (can_send_next_report())
+      const bool changed = this->state.u != this->submit_state.u
+                           || this->state.v != this->submit_state.v
+                           || this->state.w != this->submit_state.w;
+      submit_rotation();
+      this->submit_state.u = this->state.u;
+      this->submit_state.v = this->state.v;
+      this->submit_state.w = this->state.w;
+      this->dirty_reports &= ~DIRTY_ROTATION;
+      if (changed)
       {
-        submit_translation(
-          map_normal_float(this->submit_state.x, POSITION_RANGE),
-          map_normal_float(this->submit_state.y, POSITION_RANGE),
-          map_normal_float(this->submit_state.z, POSITION_RANGE)
-        );
-        this->hid_state = SEND_ROTATION;
+        this->data_age.add(now - this->rotation_millis);
       }
       break;
     }
-    case SEND_ROTATION:
+#else
+    case SEND_MOTION:
     {
-      if (can_send_next_report())
+      const bool translation_changed = this->state.x != this->submit_state.x
+                                       || this->state.y != this->submit_state.y
+                                       || this->state.z != this->submit_state.z;
+      const bool rotation_changed = this->state.u != this->submit_state.u
+                                    || this->state.v != this->submit_state.v
+                                    || this->state.w != this->submit_state.w;
+      submit_motion();
+      this->submit_state.x = this->state.x;
+      this->submit_state.y = this->state.y;
+      this->submit_state.z = this->state.z;
+      this->submit_state.u = this->state.u;
+      this->submit_state.v = this->state.v;
+      this->submit_state.w = this->state.w;
+
+      // the oldest changed part of the report counts
+      if (translation_changed || rotation_changed)
       {
-        submit_rotation(
-          map_normal_float(this->submit_state.u, ROTATION_RANGE),
-          map_normal_float(this->submit_state.v, ROTATION_RANGE),
-          map_normal_float(this->submit_state.w, ROTATION_RANGE)
-        );
-        this->hid_state = SEND_BUTTONS;
+        const uint32_t age_translation = translation_changed ? now - this->translation_millis : 0;
+        const uint32_t age_rotation = rotation_changed ? now - this->rotation_millis : 0;
+        this->data_age.add(age_translation > age_rotation ? age_translation : age_rotation);
       }
+      this->dirty_reports &= ~(DIRTY_TRANSLATION | DIRTY_ROTATION);
       break;
     }
+#endif
     case SEND_BUTTONS:
     {
-      if (can_send_next_report())
+      button_edge_t edge;
+      if (this->button_edges.pop(edge))
+      {
+        // send one report per edge, so presses shorter than a report cycle still reach the host
+        const uint32_t mask = static_cast<uint32_t>(1) << edge.button;
+        if (edge.pressed)
+        {
+          this->submit_state.buttons |= mask;
+        }
+        else
+        {
+          this->submit_state.buttons &= ~mask;
+        }
+        encode_buttons(&this->submit_button_report[1], this->submit_state.buttons);
+        submit_buttons();
+        this->data_age.add(now - edge.timestamp);
+        this->button_latency.add(now - edge.timestamp);
+      }
+      else
       {
-        submit_buttons(this->submit_state.buttons);
-        this->hid_state = IDLE;
+        // no edges queued, but some were dropped, or this is an idle repeat. send the current state
+        const bool changed = buttons_dirty();
+        this->submit_state.buttons = this->state.buttons;
+        memcpy(this->submit_button_report, this->reports.buttons, sizeof(this->submit_button_report));
+        submit_buttons();
+        if (changed)
+        {
+          this->data_age.add(now - this->button_millis);
+          this->button_latency.add(now - this->button_millis);
+        }
+      }
+
+      // stay dirty until all edges are sent
+      if (this->button_edges.empty() && !buttons_dirty())
+      {
+        this->dirty_reports &= ~DIRTY_BUTTONS;
       }
       break;
     }
     default:
     {
-      // got into a invalid state, reset to IDLE
-      this->hid_state = IDLE;
+      // nothing to send
+      break;
     }
   }
 }
@@ -239,81 +524,109 @@ void HIDSpaceMouse::get_led_state()
   
 }
 
-void HIDSpaceMouse::submit_translation(const int16_t x, const int16_t y, const int16_t z)
+const uint8_t *HIDSpaceMouse::get_cached_report(const uint8_t report_id, size_t &len) const
+{
+  switch (report_id)
+  {
+#if HID_SPACE_MOUSE_COMBINED_REPORT
+    case MOTION_REPORT_ID:
+    {
+      len = sizeof(this->reports.motion);
+      return this->reports.motion;
+    }
+#else
+    case TRANSLATION_REPORT_ID:
+    {
+      len = sizeof(this->reports.translation);
+      return this->reports.translation;
+    }
+    case ROTATION_REPORT_ID:
+    {
+      len = sizeof(this->reports.rotation);
+      return this->reports.rotation;
+    }
+#endif
+    case BUTTON_REPORT_ID:
+    {
+      len = sizeof(this->reports.buttons);
+      return this->reports.buttons;
+    }
+    default:
+    {
+      len = 0;
+      return nullptr;
+    }
+  }
+}
+
+#if HID_SPACE_MOUSE_COMBINED_REPORT
+void HIDSpaceMouse::submit_motion()
 {
   if (this->log != nullptr)
   {
-    this->log->print(F("[SpaceMouse] submit_translation("));
-    this->log->print(x);
+    this->log->print(F("[SpaceMouse] submit_motion("));
+    this->log->print(this->state.x);
     this->log->print(F(", "));
-    this->log->print(y);
+    this->log->print(this->state.y);
     this->log->print(F(", "));
-    this->log->print(z);
+    this->log->print(this->state.z);
+    this->log->print(F(", "));
+    this->log->print(this->state.u);
+    this->log->print(F(", "));
+    this->log->print(this->state.v);
+    this->log->print(F(", "));
+    this->log->print(this->state.w);
     this->log->println(F(")"));
   }
 
-  const uint8_t translation[6] = {
-    static_cast<uint8_t>(x & 0xFF), static_cast<uint8_t>(x >> 8),
-    static_cast<uint8_t>(y & 0xFF), static_cast<uint8_t>(y >> 8),
-    static_cast<uint8_t>(z & 0xFF), static_cast<uint8_t>(z >> 8)
-  };
-
-  send_report(TRANSLATION_REPORT_ID, translation, 6);
+  send_report(this->reports.motion, sizeof(this->reports.motion));
 }
-
-void HIDSpaceMouse::submit_rotation(const int16_t u, const int16_t v, const int16_t w)
+#else
+void HIDSpaceMouse::submit_translation()
 {
   if (this->log != nullptr)
   {
-    this->log->print(F("[SpaceMouse] submit_rotation("));
-    this->log->print(u);
+    this->log->print(F("[SpaceMouse] submit_translation("));
+    this->log->print(this->state.x);
     this->log->print(F(", "));
-    this->log->print(v);
+    this->log->print(this->state.y);
     this->log->print(F(", "));
-    this->log->print(w);
+    this->log->print(this->state.z);
     this->log->println(F(")"));
   }
 
-  const uint8_t rotation[6] = {
-    static_cast<uint8_t>(u & 0xFF), static_cast<uint8_t>(u >> 8),
-    static_cast<uint8_t>(v & 0xFF), static_cast<uint8_t>(v >> 8),
-    static_cast<uint8_t>(w & 0xFF), static_cast<uint8_t>(w >> 8)
-  };
-
-  send_report(ROTATION_REPORT_ID, rotation, 6);
+  send_report(this->reports.translation, sizeof(this->reports.translation));
 }
 
-void HIDSpaceMouse::submit_buttons(const bool buttons[BUTTON_COUNT])
+void HIDSpaceMouse::submit_rotation()
 {
-  size_t len = BUTTON_COUNT / 8;
-  if (BUTTON_COUNT % 8 != 0)
+  if (this->log != nullptr)
   {
-    // add one more byte for the remaining bits
-    len++;
+    this->log->print(F("[SpaceMouse] submit_rotation("));
+    this->log->print(this->state.u);
+    this->log->print(F(", "));
+    this->log->print(this->state.v);
+    this->log->print(F(", "));
+    this->log->print(this->state.w);
+    this->log->println(F(")"));
   }
 
-  uint8_t data[len];
-  memset(data, 0, len);
-
-  // pack buttons array into data bit map
-  for (size_t i = 0; i < BUTTON_COUNT; i++)
-  {
-    if (buttons[i])
-    {
-      data[i / 8] |= 1 << (i % 8);
-    }
-  }
+  send_report(this->reports.rotation, sizeof(this->reports.rotation));
+}
+#endif
 
+void HIDSpaceMouse::submit_buttons()
+{
   if (this->log != nullptr)
   {
     this->log->print(F("[SpaceMouse] submit_buttons(): "));
-    for (size_t i = 0; i < len; i++)
+    for (size_t i = 1; i < sizeof(this->submit_button_report); i++)
     {
-      this->log->print(data[i], BIN);
+      this->log->print(this->submit_button_report[i], BIN);
       this->log->print(F(" "));
     }
     this->log->println();
   }
 
-  send_report(BUTTON_REPORT_ID, data, len);
+  send_report(this->submit_button_report, sizeof(this->submit_button_report));
 }
@@ -3,12 +3,35 @@
 #include <PluggableUSB.h>
 #include <HID.h>
 #include "../util.hpp"
+#include "../ButtonEdgeQueue.hpp"
+#include "../FixedPoint.hpp"
 
 // change how ENSURE_BOUNDS works
 // 0: clamp values to limits
 // 1: assert values are within limits
 #define ENSURE_BOUNDS_MODE 1
 
+// provide set_translation_float() and set_rotation_float(), taking values in range [-1.0, 1.0]
+// 0: integer API only, the float library is not needed
+// 1: also provide the float API, for compatibility
+#define HID_SPACE_MOUSE_FLOAT_API 0
+
+// layout of the translation and rotation reports
+// 0: separate translation (ID 1) and rotation (ID 2) reports, 6 bytes each. used by older SpaceMouse devices
+// 1: a single combined motion report (ID 1) with all six axes, 12 bytes. used by newer SpaceMouse devices.
+//    motion needs only one report slot, and translation and rotation always arrive together
+// can be set from the build flags, so the host tests cover both layouts
+#ifndef HID_SPACE_MOUSE_COMBINED_REPORT
+#define HID_SPACE_MOUSE_COMBINED_REPORT 0
+#endif
+
+// resolution of the translation and rotation values sent to the host
+// 0: +-800 counts
+// 1: +-4096 counts, at least one count per raw Magellan count, so the native precision of the puck is kept
+#ifndef HID_SPACE_MOUSE_FULL_RESOLUTION
+#define HID_SPACE_MOUSE_FULL_RESOLUTION 0
+#endif
+
 #if ENSURE_BOUNDS_MODE == 0
 #define ENSURE_BOUNDS(value, min, max) value = constrain(value, min, max)
 #else
@@ -29,12 +52,30 @@ namespace hid_space_mouse_internal
    */
   constexpr uint8_t ROTATION_REPORT_ID = 2;
 
+  /**
+   * report ID for combined translation and rotation data, with HID_SPACE_MOUSE_COMBINED_REPORT.
+   * @note format: [x_lo, x_hi, y_lo, y_hi, z_lo, z_hi, u_lo, u_hi, v_lo, v_hi, w_lo, w_hi]
+   */
+  constexpr uint8_t MOTION_REPORT_ID = 1;
+
   /**
    * report ID for button data.
    * @note format: bitmap of BUTTON_COUNT bits, each representing a button
    */
   constexpr uint8_t BUTTON_REPORT_ID = 3;
   constexpr uint8_t BUTTON_COUNT = 32;
+  constexpr uint8_t BUTTON_REPORT_SIZE = (BUTTON_COUNT + 7) / 8;
+
+  /**
+   * number of input reports. input report IDs are 1 to INPUT_REPORT_COUNT
+   */
+  constexpr uint8_t INPUT_REPORT_COUNT = 3;
+
+  /**
+   * number of slots in the button edge queue.
+   * must be a power of two, the queue holds one less edge than this
+   */
+  constexpr uint8_t BUTTON_EDGE_QUEUE_SIZE = 16;
 
   /**
    * report ID for LED data.
@@ -42,6 +83,18 @@ namespace hid_space_mouse_internal
    */
   constexpr uint8_t LED_REPORT_ID = 4;
 
+#if HID_SPACE_MOUSE_FULL_RESOLUTION
+  /**
+   * range for postion (x,y,z) values when sending to the 3DConnexion software.
+   * @note the Magellan reports up to about +-4000 raw counts, so no raw count is lost
+   */
+  constexpr int16_t POSITION_RANGE[2] = {-4096, +4096};
+
+  /**
+   * range for rotation (u,v,w) values when sending to the 3DConnexion software
+   */
+  constexpr int16_t ROTATION_RANGE[2] = {-4096, +4096};
+#else
   /**
    * range for postion (x,y,z) values when sending to the 3DConnexion software
    */
@@ -51,26 +104,161 @@ namespace hid_space_mouse_internal
    * range for rotation (u,v,w) values when sending to the 3DConnexion software
    */
   constexpr int16_t ROTATION_RANGE[2] = {-800, +800};
+#endif
+
+  /**
+   * physical range of the translation and rotation values in the report descriptor.
+   * describes full deflection, so it does not change with the resolution
+   */
+  constexpr int16_t PHYSICAL_RANGE[2] = {-1400, +1400};
+
+  /**
+   * low / high byte of a 16-bit value in the report descriptor, little-endian
+   */
+  constexpr uint8_t descriptor_lo(const int16_t value)
+  {
+    return static_cast<uint8_t>(static_cast<uint16_t>(value) & 0xFF);
+  }
+
+  constexpr uint8_t descriptor_hi(const int16_t value)
+  {
+    return static_cast<uint8_t>(static_cast<uint16_t>(value) >> 8);
+  }
 
   /**
    * how often to send a HID report (minimum delay)
    */
   constexpr uint8_t HID_REPORT_RATE = 8; // 8ms
 
+  /**
+   * unit of the idle rate set by the host using SET_IDLE
+   */
+  constexpr uint8_t HID_IDLE_RATE_UNIT = 4; // 4ms
+
+  /**
+   * range the quantizer noise gate was tuned for, in HID counts
+   */
+  constexpr int16_t QUANTIZER_REFERENCE_RANGE = 800;
+
+  /**
+   * values within this many HID counts of rest are sent as rest (0).
+   * so sensor noise does not keep an untouched puck sending, and the host always gets a final all-zero report
+   * @note one count at QUANTIZER_REFERENCE_RANGE, scaled up to the actual range. so it covers the same deflection at every resolution
+   */
+  constexpr int16_t QUANTIZER_NOISE_GATE = (POSITION_RANGE[1] + QUANTIZER_REFERENCE_RANGE - 1) / QUANTIZER_REFERENCE_RANGE;
+
+#if HID_SPACE_MOUSE_FULL_RESOLUTION
+  /**
+   * values within this many HID counts of what was last sent are not sent again.
+   * @note disabled at full resolution, since it would drop the precision the full resolution is for.
+   * a puck at rest is still quiet, because of the noise gate
+   */
+  constexpr int16_t QUANTIZER_HYSTERESIS = 0;
+#else
+  /**
+   * values within this many HID counts of what was last sent are not sent again.
+   * so a value dithering between two counts does not send a report every cycle
+   */
+  constexpr int16_t QUANTIZER_HYSTERESIS = 1;
+#endif
+
+  /**
+   * number of buckets of an age_histogram_t.
+   * bucket 0 counts ages of 0 ms, bucket i counts ages in range [2^(i-1), 2^i) ms. the last bucket counts everything above
+   */
+  constexpr uint8_t AGE_HISTOGRAM_BUCKETS = 9;
+
+  /**
+   * histogram of ages, e.g. how old data was when it was sent to the host
+   */
+  struct age_histogram_t
+  {
+    uint16_t buckets[AGE_HISTOGRAM_BUCKETS];
+
+    /**
+     * add a sample
+     * @param age the age, in milliseconds
+     */
+    void add(const uint32_t age)
+    {
+      uint8_t bucket = 0;
+      for (uint32_t a = age; a != 0 && bucket < (AGE_HISTOGRAM_BUCKETS - 1); a >>= 1)
+      {
+        bucket++;
+      }
+
+      // saturate, so the histogram stays meaningful when running for a long time
+      if (buckets[bucket] != 0xFFFF)
+      {
+        buckets[bucket]++;
+      }
+    }
+
+    /**
+     * get an upper bound of a percentile
+     * @param percent the percentile, e.g. 99
+     * @return upper bound of the bucket that contains the percentile, in milliseconds. 0 if there are no samples
+     */
+    uint16_t percentile(const uint8_t percent) const
+    {
+      uint32_t total = 0;
+      for (uint8_t i = 0; i < AGE_HISTOGRAM_BUCKETS; i++)
+      {
+        total += buckets[i];
+      }
+
+      const uint32_t target = (total * percent + 99) / 100;
+      uint32_t count = 0;
+      for (uint8_t i = 0; i < AGE_HISTOGRAM_BUCKETS; i++)
+      {
+        count += buckets[i];
+        if (count >= target && count != 0)
+        {
+          return i == 0 ? 0 : (1 << i) - 1;
+        }
+      }
+
+      return 0;
+    }
+  };
+
   /**
    * HID Report Descriptor to set up communication with the 3DConnexion software.
+   * @note the logical ranges are taken from POSITION_RANGE and ROTATION_RANGE, so they always match the sent values
    */
   static const uint8_t SPACE_MOUSE_REPORT_DESCRIPTOR[] PROGMEM = {
       0x05, 0x01,         // Usage Page (Generic Desktop)
       0x09, 0x08,         // Usage (Multi-Axis)
       0xA1, 0x01,         // Collection (Application)
+#if HID_SPACE_MOUSE_COMBINED_REPORT
+                          // Report 1: Translation and Rotation
+      0xa1, 0x00,         // Collection (Physical)
+      0x85, 0x01,         // Report ID (1)
+      0x16, descriptor_lo(POSITION_RANGE[0]), descriptor_hi(POSITION_RANGE[0]), // Logical Minimum
+      0x26, descriptor_lo(POSITION_RANGE[1]), descriptor_hi(POSITION_RANGE[1]), // Logical Maximum
+      0x36, descriptor_lo(PHYSICAL_RANGE[0]), descriptor_hi(PHYSICAL_RANGE[0]), // Physical Minimum
+      0x46, descriptor_lo(PHYSICAL_RANGE[1]), descriptor_hi(PHYSICAL_RANGE[1]), // Physical Maximum
+      0x09, 0x30,         // Usage (X)
+      0x09, 0x31,         // Usage (Y)
+      0x09, 0x32,         // Usage (Z)
+      0x75, 0x10,         // Report Size (16)
+      0x95, 0x03,         // Report Count (3)
+      0x81, 0x02,         // Input (variable,absolute)
+      0x16, descriptor_lo(ROTATION_RANGE[0]), descriptor_hi(ROTATION_RANGE[0]), // Logical Minimum
+      0x26, descriptor_lo(ROTATION_RANGE[1]), descriptor_hi(ROTATION_RANGE[1]), // Logical Maximum
+      0x09, 0x33,         // Usage (RX)
+      0x09, 0x34,         // Usage (RY)
+      0x09, 0x35,         // Usage (RZ)
+      0x81, 0x02,         // Input (variable,absolute)
+      0xC0,               // End Collection
+#else
                           // Report 1: Translation
       0xa1, 0x00,         // Collection (Physical)
       0x85, 0x01,         // Report ID (1)
-      0x16, 0xA2, 0xFE,   // Logical Minimum (-350) (0xFEA2 in little-endian)
-      0x26, 0x5E, 0x01,   // Logical Maximum (350) (0x015E in little-endian)
-      0x36, 0x88, 0xFA,   // Physical Minimum (-1400) (0xFA88 in little-endian)
-      0x46, 0x78, 0x05,   // Physical Maximum (1400) (0x0578 in little-endian)
+      0x16, descriptor_lo(POSITION_RANGE[0]), descriptor_hi(POSITION_RANGE[0]), // Logical Minimum
+      0x26, descriptor_lo(POSITION_RANGE[1]), descriptor_hi(POSITION_RANGE[1]), // Logical Maximum
+      0x36, descriptor_lo(PHYSICAL_RANGE[0]), descriptor_hi(PHYSICAL_RANGE[0]), // Physical Minimum
+      0x46, descriptor_lo(PHYSICAL_RANGE[1]), descriptor_hi(PHYSICAL_RANGE[1]), // Physical Maximum
       0x09, 0x30,         // Usage (X)
       0x09, 0x31,         // Usage (Y)
       0x09, 0x32,         // Usage (Z)
@@ -81,10 +269,10 @@ namespace hid_space_mouse_internal
                           // Report 2: Rotation
       0xa1, 0x00,         // Collection (Physical)
       0x85, 0x02,         // Report ID (2)
-      0x16, 0xA2, 0xFE,   // Logical Minimum (-350)
-      0x26, 0x5E, 0x01,   // Logical Maximum (350)
-      0x36, 0x88, 0xFA,   // Physical Minimum (-1400)
-      0x46, 0x78, 0x05,   // Physical Maximum (1400)
+      0x16, descriptor_lo(ROTATION_RANGE[0]), descriptor_hi(ROTATION_RANGE[0]), // Logical Minimum
+      0x26, descriptor_lo(ROTATION_RANGE[1]), descriptor_hi(ROTATION_RANGE[1]), // Logical Maximum
+      0x36, descriptor_lo(PHYSICAL_RANGE[0]), descriptor_hi(PHYSICAL_RANGE[0]), // Physical Minimum
+      0x46, descriptor_lo(PHYSICAL_RANGE[1]), descriptor_hi(PHYSICAL_RANGE[1]), // Physical Maximum
       0x09, 0x33,         // Usage (RX)
       0x09, 0x34,         // Usage (RY)
       0x09, 0x35,         // Usage (RZ)
@@ -92,6 +280,7 @@ namespace hid_space_mouse_internal
       0x95, 0x03,         // Report Count (3)
       0x81, 0x02,         // Input (variable,absolute)
       0xC0,               // End Collection
+#endif
                           // Report 3: Keys
       0xa1, 0x00,         // Collection (Physical)
       0x85, 0x03,         //  Report ID (3)
@@ -156,10 +345,17 @@ protected:
   bool setup(USBSetup &setup);
 
   int write(const uint8_t *buffer, const size_t len);
-  int send_report(const uint8_t report_id, const uint8_t *data, const size_t len);
+
+  /**
+   * send a report in a single transfer
+   * @param report the encoded report, starting with the report ID
+   * @param len length of the report, including the report ID
+   */
+  int send_report(const uint8_t *report, const size_t len);
+
   int read_single_byte();
 
-  uint32_t last_hid_report_millis;
+  uint32_t last_hid_report_millis = 0;
 
   /**
    * check if the next HID report can be sent
@@ -179,9 +375,10 @@ protected:
 
   enum hid_state_t
   {
-    IDLE,             // wait for state to be updated, if yes commit and go to SEND_TRANSLATION
+    IDLE,             // no report is dirty
     SEND_TRANSLATION, // send translation data
     SEND_ROTATION,    // send rotation data
+    SEND_MOTION,      // send translation and rotation data in one report, with HID_SPACE_MOUSE_COMBINED_REPORT
     SEND_BUTTONS      // send button data
   };
 
@@ -191,44 +388,105 @@ public: // SpaceMouse API
   /**
    * update the state of the state mouse.
    * @note this should be called regularly to keep the state up to date
-   * @note if you change the state of the space mouse, call submit() to send the data to the 3DConnexion software
+   * @note
+   * sends at most one report per HID_REPORT_RATE.
+   * reports are encoded when they are sent, so they always carry the latest values
+   * @note
+   * unchanged reports are only repeated if the host set an idle rate for them using SET_IDLE.
+   * by default, the idle rate is 0 and nothing is sent while the puck is at rest
    */
   void update();
 
   /**
    * set the translation of the space mouse
-   * @param x x translation. range: -1.0 to 1.0
-   * @param y y translation. range: -1.0 to 1.0
-   * @param z z translation. range: -1.0 to 1.0
-   * @note call submit() to send the data to the 3DConnexion software
+   * @param x x translation. range: Q15_MIN to Q15_MAX
+   * @param y y translation. range: Q15_MIN to Q15_MAX
+   * @param z z translation. range: Q15_MIN to Q15_MAX
+   * @note
+   * the values are quantized to HID counts here, and sent by update() if they changed.
+   * changes within QUANTIZER_HYSTERESIS counts of the sent values and values within QUANTIZER_NOISE_GATE counts of rest are suppressed
+   */
+  void set_translation(const q15_t x, const q15_t y, const q15_t z);
+
+  /**
+   * set the rotation of the space mouse
+   * @param u rotation around x axis. range: Q15_MIN to Q15_MAX
+   * @param v rotation around y axis. range: Q15_MIN to Q15_MAX
+   * @param w rotation around z axis. range: Q15_MIN to Q15_MAX
+   * @note
+   * the values are quantized to HID counts here, and sent by update() if they changed.
+   * changes within QUANTIZER_HYSTERESIS counts of the sent values and values within QUANTIZER_NOISE_GATE counts of rest are suppressed
+   */
+  void set_rotation(const q15_t u, const q15_t v, const q15_t w);
+
+  /**
+   * set the translation of the space mouse, in HID counts
+   * @param x x translation. range: POSITION_RANGE
+   * @param y y translation. range: POSITION_RANGE
+   * @param z z translation. range: POSITION_RANGE
+   * @note for values that are already mapped to the HID range, e.g. by axis_pipeline_t::counts(). see set_translation()
+   */
+  void set_translation_counts(const int16_t x, const int16_t y, const int16_t z);
+
+  /**
+   * set the rotation of the space mouse, in HID counts
+   * @param u rotation around x axis. range: ROTATION_RANGE
+   * @param v rotation around y axis. range: ROTATION_RANGE
+   * @param w rotation around z axis. range: ROTATION_RANGE
+   * @note for values that are already mapped to the HID range, e.g. by axis_pipeline_t::counts(). see set_rotation()
+   */
+  void set_rotation_counts(const int16_t u, const int16_t v, const int16_t w);
+
+#if HID_SPACE_MOUSE_FLOAT_API
+  /**
+   * set the translation of the space mouse, see set_translation()
+   * @note range: -1.0 to 1.0
    */
-  inline void set_translation(const float x, const float y, const float z)
+  inline void set_translation_float(const float x, const float y, const float z)
   {
     ENSURE_BOUNDS(x, -1.0f, 1.0f);
     ENSURE_BOUNDS(y, -1.0f, 1.0f);
     ENSURE_BOUNDS(z, -1.0f, 1.0f);
 
-    this->state.x = x;
-    this->state.y = y;
-    this->state.z = z;
+    set_translation(q15_from_float(x), q15_from_float(y), q15_from_float(z));
   }
 
   /**
-   * set the rotation of the space mouse
-   * @param u rotation around x axis. range: -1.0 to 1.0
-   * @param v rotation around y axis. range: -1.0 to 1.0
-   * @param w rotation around z axis. range: -1.0 to 1.0
-   * @note call submit() to send the data to the 3DConnexion software
+   * set the rotation of the space mouse, see set_rotation()
+   * @note range: -1.0 to 1.0
    */
-  inline void set_rotation(const float u, const float v, const float w)
+  inline void set_rotation_float(const float u, const float v, const float w)
   {
     ENSURE_BOUNDS(u, -1.0f, 1.0f);
     ENSURE_BOUNDS(v, -1.0f, 1.0f);
     ENSURE_BOUNDS(w, -1.0f, 1.0f);
 
-    this->state.u = u;
-    this->state.v = v;
-    this->state.w = w;
+    set_rotation(q15_from_float(u), q15_from_float(v), q15_from_float(w));
+  }
+#endif
+
+  /**
+   * reset translation, rotation and all buttons to neutral
+   * @note use when the input device is lost, so the host does not keep moving
+   */
+  inline void set_neutral()
+  {
+    set_translation(0, 0, 0);
+    set_rotation(0, 0, 0);
+
+    // pending edges are obsolete, the released state is sent as a whole
+    this->button_edges.clear();
+    this->state.buttons = 0;
+    memset(&this->reports.buttons[1], 0, hid_space_mouse_internal::BUTTON_REPORT_SIZE);
+    this->button_millis = millis();
+    if (buttons_dirty())
+    {
+      this->dirty_reports |= DIRTY_BUTTONS;
+    }
+    else
+    {
+      this->dirty_reports &= ~DIRTY_BUTTONS;
+    }
   }
 
   /**
@@ -253,6 +511,22 @@ public: // SpaceMouse API
     ROTATE = 26,  // "Rotate"
   };
 
+  /**
+   * check that a button mapping uses every button at most once, so it is a permutation of its targets
+   * @param buttons the mapped buttons
+   * @param count number of entries in buttons
+   * @return true if no two entries are the same button, and all are in range
+   * @note constexpr, for use in a static_assert on a constant mapping table
+   */
+  static constexpr bool buttons_unique(const KnownButton *buttons, const uint8_t count, const uint8_t i = 0, const uint32_t used = 0)
+  {
+    return i == count
+               ? true
+               : buttons[i] < hid_space_mouse_internal::BUTTON_COUNT
+                     && (used & (static_cast<uint32_t>(1) << buttons[i])) == 0
+                     && buttons_unique(buttons, count, i + 1, used | (static_cast<uint32_t>(1) << buttons[i]));
+  }
+
   /**
    * set the state of a button
    * @param button the button to set
@@ -267,12 +541,35 @@ public: // SpaceMouse API
    * set the state of a button
    * @param button the button to set
    * @param state the state of the button
+   * @note every change is sent in its own button report, in order. so a press and release before the next report are not lost
    */
   inline void set_button(const uint8_t button, const bool state)
   {
     assert(button < hid_space_mouse_internal::BUTTON_COUNT, "HIDSpaceMouse::set_button() button out of range");
 
-    this->state.buttons[button] = state;
+    const uint32_t mask = static_cast<uint32_t>(1) << button;
+    if (((this->state.buttons & mask) != 0) == state)
+    {
+      return;
+    }
+
+    // the report is the bitmask in little-endian, so only the byte of the button changes
+    this->state.buttons ^= mask;
+    this->reports.buttons[1 + (button / 8)] ^= 1 << (button % 8);
+    this->button_millis = millis();
+    this->dirty_reports |= DIRTY_BUTTONS;
+
+    // if the queue is full, the current state is sent once the queue has drained
+    const button_edge_t edge = {this->button_millis, button, state};
+    this->button_edges.push(edge);
+  }
+
+  /**
+   * number of button edges that were dropped because the edge queue was full
+   */
+  inline uint16_t get_button_edge_overflows() const
+  {
+    return button_edges.get_overflows();
   }
 
   /**
@@ -283,44 +580,180 @@ public: // SpaceMouse API
     return ledState;
   }
 
+  /**
+   * get the histogram of how old the data in each report was when it was sent, in milliseconds.
+   * the age of translation and rotation is counted from the set_translation() / set_rotation() call,
+   * the age of buttons from the set_button() call
+   */
+  inline const hid_space_mouse_internal::age_histogram_t &get_data_age() const
+  {
+    return data_age;
+  }
+
+  /**
+   * get the histogram of the button-to-host latency, in milliseconds.
+   * counted from the set_button() call until the report with the change was sent
+   * @note button changes are sent before any pending translation or rotation report
+   */
+  inline const hid_space_mouse_internal::age_histogram_t &get_button_latency() const
+  {
+    return button_latency;
+  }
+
+  /**
+   * clear the data age and button latency histograms
+   */
+  inline void reset_data_age()
+  {
+    memset(&data_age, 0, sizeof(data_age));
+    memset(&button_latency, 0, sizeof(button_latency));
+  }
+
 private:
   struct mouse_state_t
   {
-    float x,
+    // translation and rotation, in HID counts
+    int16_t x,
         y,
         z,
         u, // rx
         v, // ry
         w; // rz
 
-    bool buttons[hid_space_mouse_internal::BUTTON_COUNT];
+    // bit i is button i, the same layout as the button report
+    uint32_t buttons;
   };
 
+  static_assert(hid_space_mouse_internal::BUTTON_COUNT <= 32, "mouse_state_t::buttons is too small for BUTTON_COUNT!");
+
   /**
    * active state of the space mouse
    */
   mouse_state_t state;
 
   /**
-   * state of the space mouse that was last submitted (or is currently being submitted)
+   * state of the space mouse that was last sent to the host
    */
   mouse_state_t submit_state;
 
   /**
-   * did the state change since the last submit() call?
+   * input reports encoded from the active state, starting with the report ID.
+   * refreshed whenever the state changes, only the bytes of changed axes and buttons are written.
+   * so reports are sent and GET_REPORT is answered without encoding anything
+   */
+  struct report_cache_t
+  {
+#if HID_SPACE_MOUSE_COMBINED_REPORT
+    uint8_t motion[1 + 12];
+#else
+    uint8_t translation[1 + 6];
+    uint8_t rotation[1 + 6];
+#endif
+    uint8_t buttons[1 + hid_space_mouse_internal::BUTTON_REPORT_SIZE];
+  };
+
+  report_cache_t reports;
+
+  /**
+   * the translation / rotation axes in the report cache
+   */
+#if HID_SPACE_MOUSE_COMBINED_REPORT
+  inline uint8_t *translation_data() { return &reports.motion[1]; }
+  inline uint8_t *rotation_data() { return &reports.motion[7]; }
+#else
+  inline uint8_t *translation_data() { return &reports.translation[1]; }
+  inline uint8_t *rotation_data() { return &reports.rotation[1]; }
+#endif
+
+  /**
+   * the button report that was last sent, encoded.
+   * differs from the cached report while queued edges are sent one by one
+   */
+  uint8_t submit_button_report[1 + hid_space_mouse_internal::BUTTON_REPORT_SIZE];
+
+  /**
+   * get a cached input report
+   * @param report_id the report ID
+   * @param len receives the length of the report, including the report ID
+   * @return the report, or nullptr if there is no input report with this ID
+   */
+  const uint8_t *get_cached_report(const uint8_t report_id, size_t &len) const;
+
+  /**
+   * protocol selected by the host using SET_PROTOCOL
+   */
+  uint8_t protocol = HID_REPORT_PROTOCOL;
+
+  /**
+   * when the translation, rotation and buttons were last changed, in millis.
+   * used to measure the data age
+   */
+  uint32_t translation_millis = 0;
+  uint32_t rotation_millis = 0;
+  uint32_t button_millis = 0;
+
+  /**
+   * histogram of the data age at the time it was sent
+   */
+  hid_space_mouse_internal::age_histogram_t data_age;
+
+  /**
+   * histogram of the button-to-host latency
    */
-  inline bool state_dirty() const
+  hid_space_mouse_internal::age_histogram_t button_latency;
+
+  /**
+   * button changes that were not yet sent, oldest first
+   */
+  ButtonEdgeQueue<hid_space_mouse_internal::BUTTON_EDGE_QUEUE_SIZE> button_edges;
+
+  /**
+   * reports that have to be sent, because their encoded values changed
+   */
+  enum dirty_report_t : uint8_t
   {
-    return memcmp(&state, &submit_state, sizeof(mouse_state_t)) != 0;
+    DIRTY_TRANSLATION = 1 << 0,
+    DIRTY_ROTATION = 1 << 1,
+    DIRTY_BUTTONS = 1 << 2
+  };
+
+  uint8_t dirty_reports = 0;
+
+  /**
+   * idle rate of each input report, set by the host using SET_IDLE. index is report ID - 1.
+   * in units of HID_IDLE_RATE_UNIT, 0 means the report is only sent when it changed
+   */
+  uint8_t idle_rates[hid_space_mouse_internal::INPUT_REPORT_COUNT] = {0, 0, 0};
+
+  /**
+   * when each input report was last sent, in millis. index is report ID - 1
+   */
+  uint32_t report_millis[hid_space_mouse_internal::INPUT_REPORT_COUNT] = {0, 0, 0};
+
+  /**
+   * did the idle rate of a report elapse since it was last sent?
+   * @param report_id the input report ID
+   * @param now the current time, in millis
+   * @return true if the report has to be repeated
+   */
+  inline bool idle_elapsed(const uint8_t report_id, const uint32_t now) const
+  {
+    const uint8_t rate = idle_rates[report_id - 1];
+    return rate != 0 && (now - report_millis[report_id - 1]) >= static_cast<uint16_t>(rate) * hid_space_mouse_internal::HID_IDLE_RATE_UNIT;
   }
 
   /**
-   * commit the active state to the last state
-   * @note copies this->state to this->submit_state
+   * get the state that sends the next dirty report
+   * @return the SEND_* state, or IDLE if no report is dirty
    */
-  inline void commit_state()
+  hid_state_t next_dirty_state() const;
+
+  /**
+   * did the buttons change since they were last submitted?
+   */
+  inline bool buttons_dirty() const
   {
-    memcpy(&submit_state, &state, sizeof(mouse_state_t));
+    return state.buttons != submit_state.buttons;
   }
 
   /**
@@ -336,26 +769,27 @@ private:
    */
   void get_led_state();
 
+#if !HID_SPACE_MOUSE_COMBINED_REPORT
   /**
-   * Send translation data to 3DConnexion software.
-   * @param x x translation
-   * @param y y translation
-   * @param z z translation
+   * Send the translation of the active state to 3DConnexion software, from the report cache.
    */
-  void submit_translation(const int16_t x, const int16_t y, const int16_t z);
+  void submit_translation();
 
   /**
-   * Send rotation data to 3DConnexion software.
-   * @param u rotation around x axis
-   * @param v rotation around y axis
-   * @param w rotation around z axis
+   * Send the rotation of the active state to 3DConnexion software, from the report cache.
    */
-  void submit_rotation(const int16_t u, const int16_t v, const int16_t w);
+  void submit_rotation();
+#else
+  /**
+   * Send the translation and rotation of the active state to 3DConnexion software, in a single report from the report cache.
+   */
+  void submit_motion();
+#endif
 
   /**
-   * Send the button data to the 3DConnexion software.
+   * Send submit_button_report to the 3DConnexion software.
    */
-  void submit_buttons(const bool buttons[hid_space_mouse_internal::BUTTON_COUNT]);
+  void submit_buttons();
 };
 
 // ensure VID and PID are changed as needed
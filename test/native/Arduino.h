@@ -0,0 +1,150 @@
+#pragma once
+/**
+ * minimal Arduino core for running the firmware sources on the host, using the PlatformIO native environment.
+ * only what the sources in src/ use is provided.
+ *
+ * @note
+ * time does not pass on its own. tests advance it using native::advance_millis() / native::advance_micros()
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+
+#define DEC 10
+#define HEX 16
+#define BIN 2
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+#define lowByte(w) ((uint8_t)((w) & 0xff))
+#define highByte(w) ((uint8_t)((w) >> 8))
+#define _BV(bit) (1 << (bit))
+
+#ifndef abs
+#define abs(x) ((x) > 0 ? (x) : -(x))
+#endif
+
+namespace native
+{
+  /**
+   * current host time, in microseconds
+   */
+  inline uint32_t &now_micros()
+  {
+    static uint32_t now = 0;
+    return now;
+  }
+
+  inline void advance_micros(const uint32_t us) { now_micros() += us; }
+  inline void advance_millis(const uint32_t ms) { now_micros() += ms * 1000; }
+}
+
+inline unsigned long micros() { return native::now_micros(); }
+inline unsigned long millis() { return native::now_micros() / 1000; }
+inline void delay(const unsigned long ms) { native::advance_millis(ms); }
+inline void delayMicroseconds(const unsigned int us) { native::advance_micros(us); }
+
+class Print
+{
+public:
+  virtual ~Print() {}
+
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size)
+  {
+    size_t n = 0;
+    while (size-- > 0)
+    {
+      n += write(*buffer++);
+    }
+    return n;
+  }
+
+  size_t write(const char *str) { return str == nullptr ? 0 : write(reinterpret_cast<const uint8_t *>(str), strlen(str)); }
+
+  virtual int availableForWrite() { return 0; }
+  virtual void flush() {}
+
+  size_t print(const __FlashStringHelper *str) { return write(reinterpret_cast<const char *>(str)); }
+  size_t print(const char *str) { return write(str); }
+  size_t print(char c) { return write(static_cast<uint8_t>(c)); }
+  size_t print(unsigned char n, int base = DEC) { return print(static_cast<unsigned long>(n), base); }
+  size_t print(int n, int base = DEC) { return print(static_cast<long>(n), base); }
+  size_t print(unsigned int n, int base = DEC) { return print(static_cast<unsigned long>(n), base); }
+  size_t print(long n, int base = DEC) { return base == DEC ? format("%ld", n) : print(static_cast<unsigned long>(n), base); }
+  size_t print(unsigned long n, int base = DEC)
+  {
+    if (base == BIN)
+    {
+      char buffer[33];
+      char *p = &buffer[sizeof(buffer) - 1];
+      *p = '\0';
+      do
+      {
+        *--p = '0' + (n & 1);
+        n >>= 1;
+      } while (n != 0);
+      return print(p);
+    }
+    return format(base == HEX ? "%lX" : "%lu", n);
+  }
+  size_t print(double n, int digits = 2) { return format("%.*f", digits, n); }
+
+  size_t println() { return write(static_cast<uint8_t>('\r')) + write(static_cast<uint8_t>('\n')); }
+
+  template <typename T>
+  size_t println(T value) { return print(value) + println(); }
+
+  template <typename T>
+  size_t println(T value, int format) { return print(value, format) + println(); }
+
+private:
+  template <typename... T>
+  size_t format(const char *fmt, T... args)
+  {
+    char buffer[40];
+    snprintf(buffer, sizeof(buffer), fmt, args...);
+    return write(buffer);
+  }
+};
+
+class Stream : public Print
+{
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+};
+
+/**
+ * serial port without anything attached. reads nothing, writes to stdout
+ */
+class HardwareSerial : public Stream
+{
+public:
+  void begin(unsigned long baud) { (void)baud; }
+  void end() {}
+
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+
+  size_t write(uint8_t c) override { return fputc(c, stdout) == EOF ? 0 : 1; }
+  int availableForWrite() override { return 64; }
+  void flush() override { fflush(stdout); }
+  using Print::write;
+
+  operator bool() { return true; }
+};
+
+static HardwareSerial Serial;
+static HardwareSerial Serial1;
@@ -0,0 +1,83 @@
+#pragma once
+/**
+ * helpers for driving HIDSpaceMouse on the host, acting as the USB host
+ */
+#include <vector>
+#include "spacemouse/HIDSpaceMouse.hpp"
+
+namespace fake_host
+{
+  /**
+   * HIDSpaceMouse with the PluggableUSB callbacks made public, so tests can send control requests
+   */
+  class SpaceMouse : public HIDSpaceMouse
+  {
+  public:
+    using HIDSpaceMouse::getDescriptor;
+    using HIDSpaceMouse::setup;
+  };
+
+  /**
+   * run update() for a number of report slots, advancing the time by HID_REPORT_RATE before each
+   * @param mouse the space mouse
+   * @param slots number of report slots
+   */
+  inline void run_slots(HIDSpaceMouse &mouse, const uint16_t slots)
+  {
+    for (uint16_t i = 0; i < slots; i++)
+    {
+      native::advance_millis(hid_space_mouse_internal::HID_REPORT_RATE);
+      mouse.update();
+    }
+  }
+
+  /**
+   * send a class request from the host to the device (IN data stage)
+   * @param mouse the space mouse
+   * @param request bRequest, e.g. HID_GET_REPORT
+   * @param value_hi wValueH
+   * @param value_lo wValueL
+   * @param length wLength
+   * @return the data the device answered with. empty if the request was stalled
+   */
+  inline std::vector<uint8_t> control_in(SpaceMouse &mouse, const uint8_t request, const uint8_t value_hi, const uint8_t value_lo, const uint16_t length = 64)
+  {
+    USBSetup setup = {REQUEST_DEVICETOHOST_CLASS_INTERFACE, request, value_lo, value_hi, 0, length};
+    native::usb().control.clear();
+    if (!mouse.setup(setup))
+    {
+      return std::vector<uint8_t>();
+    }
+    return native::usb().control;
+  }
+
+  /**
+   * send a class request from the host to the device (no data stage)
+   * @return true if the device accepted the request
+   */
+  inline bool control_out(SpaceMouse &mouse, const uint8_t request, const uint8_t value_hi, const uint8_t value_lo)
+  {
+    USBSetup setup = {REQUEST_HOSTTODEVICE_CLASS_INTERFACE, request, value_lo, value_hi, 0, 0};
+    return mouse.setup(setup);
+  }
+
+  /**
+   * fetch the HID report descriptor, like the host does during enumeration
+   */
+  inline std::vector<uint8_t> report_descriptor(SpaceMouse &mouse)
+  {
+    USBSetup setup = {REQUEST_DEVICETOHOST_STANDARD_INTERFACE, 6, 0, HID_REPORT_DESCRIPTOR_TYPE, 0, 0xFFFF};
+    native::usb().control.clear();
+    mouse.getDescriptor(setup);
+    return native::usb().control;
+  }
+
+  /**
+   * little-endian encoding of an axis value in a report
+   */
+  inline void append_axis(std::vector<uint8_t> &report, const int16_t value)
+  {
+    report.push_back(static_cast<uint8_t>(static_cast<uint16_t>(value) & 0xFF));
+    report.push_back(static_cast<uint8_t>(static_cast<uint16_t>(value) >> 8));
+  }
+}
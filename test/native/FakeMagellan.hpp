@@ -0,0 +1,323 @@
+#pragma once
+/**
+ * helpers for driving MagellanParser on the host
+ */
+#include <deque>
+#include <string>
+#include <vector>
+#include "magellan/MagellanParser.hpp"
+
+namespace fake_magellan
+{
+  /**
+   * pipeline that maps every axis to itself, with the full raw range as calibration
+   */
+  typedef magellan_internal::axis_pipeline_t<
+      magellan_internal::axis_map_t<magellan_internal::AXIS_X, -4096, 4095>,
+      magellan_internal::axis_map_t<magellan_internal::AXIS_Y, -4096, 4095>,
+      magellan_internal::axis_map_t<magellan_internal::AXIS_Z, -4096, 4095>,
+      magellan_internal::axis_map_t<magellan_internal::AXIS_U, -4096, 4095>,
+      magellan_internal::axis_map_t<magellan_internal::AXIS_V, -4096, 4095>,
+      magellan_internal::axis_map_t<magellan_internal::AXIS_W, -4096, 4095>>
+      identity_pipeline;
+
+  /**
+   * encode a raw axis value as four nibble characters
+   * @param value the value, range -4096 to 4095
+   */
+  inline std::string encode_word(const int16_t value)
+  {
+    const uint16_t word = value < 0 ? static_cast<uint16_t>(value + 4096) : static_cast<uint16_t>(0x8000 | value);
+    std::string s;
+    for (int8_t shift = 12; shift >= 0; shift -= 4)
+    {
+      s += magellan_internal::NIBBLE_CHARS[(word >> shift) & 0x0F];
+    }
+    return s;
+  }
+
+  /**
+   * a complete position / rotation message, as sent in mode 3
+   */
+  inline std::string position_message(const int16_t x, const int16_t y, const int16_t z, const int16_t u, const int16_t v, const int16_t w)
+  {
+    // word order on the wire is x, z, y, u, w, v
+    return "d" + encode_word(x) + encode_word(z) + encode_word(y) + encode_word(u) + encode_word(w) + encode_word(v) + "\r";
+  }
+
+  /**
+   * a complete position / rotation message, as sent in the given reporting mode
+   * @param mode MODE_TRANSLATION, MODE_ROTATION or MODE_TRANSLATION_ROTATION
+   * @note modes 1 and 2 send only the words of their group, in the order of the full message. see POSITION_PAYLOAD_LENGTH_SINGLE
+   */
+  inline std::string position_message(const uint8_t mode, const int16_t x, const int16_t y, const int16_t z, const int16_t u, const int16_t v, const int16_t w)
+  {
+    switch (mode)
+    {
+      case magellan_internal::MODE_TRANSLATION: return "d" + encode_word(x) + encode_word(z) + encode_word(y) + "\r";
+      case magellan_internal::MODE_ROTATION: return "d" + encode_word(u) + encode_word(w) + encode_word(v) + "\r";
+      default: return position_message(x, y, z, u, v, w);
+    }
+  }
+
+  /**
+   * a complete keypress message
+   * @param buttons button bits, as returned by MagellanParser::get_buttons()
+   */
+  inline std::string keypress_message(const uint16_t buttons)
+  {
+    std::string s = "k";
+    s += magellan_internal::NIBBLE_CHARS[buttons & 0x0F];
+    s += magellan_internal::NIBBLE_CHARS[(buttons >> 4) & 0x0F];
+    s += magellan_internal::NIBBLE_CHARS[(buttons >> 8) & 0x0F];
+    return s + "\r";
+  }
+
+  /**
+   * inject received bytes, as the RX interrupt would
+   */
+  inline void receive(MagellanSerial &serial, const std::string &data)
+  {
+    for (const char c : data)
+    {
+      serial.receive(static_cast<uint8_t>(c), false, false);
+    }
+  }
+
+  /**
+   * simulated space mouse, answering the commands written by MagellanParser.
+   * set as tx sink of the MagellanSerial the parser uses, and call tick() once per millisecond
+   *
+   * @note
+   * answers are sent at one character per millisecond, roughly 9600 baud.
+   * while resetting, the space mouse is busy and commands sent to it are lost
+   */
+  class FakePuck : public Print
+  {
+  public:
+    /**
+     * a command received by the space mouse
+     */
+    struct command_t
+    {
+      uint32_t millis; // when the command was complete
+      std::string text; // without MESSAGE_END
+      bool lost;        // sent while the space mouse was busy
+    };
+
+    explicit FakePuck(MagellanSerial &serial) : serial(serial)
+    {
+      serial.set_tx_sink(this);
+    }
+
+    /**
+     * is the space mouse powered? an unpowered space mouse ignores everything
+     */
+    bool powered = true;
+
+    /**
+     * how long the space mouse is busy after a reset
+     */
+    uint32_t reset_duration = 200; // ms
+
+    /**
+     * delay before answering a command
+     */
+    uint32_t answer_delay = 2; // ms
+
+    /**
+     * current reporting mode, as a nibble character of NIBBLE_CHARS
+     */
+    char mode = '3';
+
+    /**
+     * first characters of the commands the space mouse does not answer
+     */
+    std::string silent_commands;
+
+    /**
+     * every command received, in order
+     */
+    std::vector<command_t> commands;
+
+    size_t write(const uint8_t c) override
+    {
+      if (!powered)
+      {
+        return 1;
+      }
+
+      if (c != '\r')
+      {
+        line += static_cast<char>(c);
+        return 1;
+      }
+
+      if (!line.empty())
+      {
+        handle(line);
+      }
+      line.clear();
+      return 1;
+    }
+
+    using Print::write;
+
+    /**
+     * send the next pending answer character, if it is due
+     */
+    void tick()
+    {
+      if (!powered || answer.empty() || millis() < answer.front().first)
+      {
+        return;
+      }
+
+      serial.receive(static_cast<uint8_t>(answer.front().second), false, false);
+      answer.pop_front();
+    }
+
+    /**
+     * send data to the parser, as if the space mouse sent it on its own
+     */
+    void send(const std::string &data)
+    {
+      queue_answer(data, 0);
+    }
+
+    /**
+     * send a position / rotation message in the current reporting mode
+     */
+    void send_position(const int16_t x, const int16_t y, const int16_t z, const int16_t u, const int16_t v, const int16_t w)
+    {
+      send(position_message(get_mode(), x, y, z, u, v, w));
+    }
+
+    /**
+     * current reporting mode, as number
+     */
+    uint8_t get_mode() const
+    {
+      return static_cast<uint8_t>(std::string(magellan_internal::NIBBLE_CHARS).find(mode));
+    }
+
+    /**
+     * lose power, and with it the configuration
+     */
+    void power_off()
+    {
+      powered = false;
+      answer.clear();
+      line.clear();
+      mode = '3';
+    }
+
+    /**
+     * find the first command with the given text
+     * @return the command, or nullptr if it was never sent
+     */
+    const command_t *find(const std::string &text) const
+    {
+      for (const command_t &command : commands)
+      {
+        if (command.text == text)
+        {
+          return &command;
+        }
+      }
+      return nullptr;
+    }
+
+    /**
+     * find the last command with the given text
+     * @return the command, or nullptr if it was never sent
+     */
+    const command_t *find_last(const std::string &text) const
+    {
+      for (auto command = commands.rbegin(); command != commands.rend(); command++)
+      {
+        if (command->text == text)
+        {
+          return &*command;
+        }
+      }
+      return nullptr;
+    }
+
+    /**
+     * number of commands with the given text
+     */
+    size_t count(const std::string &text) const
+    {
+      size_t n = 0;
+      for (const command_t &command : commands)
+      {
+        n += command.text == text ? 1 : 0;
+      }
+      return n;
+    }
+
+  private:
+    MagellanSerial &serial;
+    std::string line;
+    std::deque<std::pair<uint32_t, char>> answer; // characters to send, and when
+    uint32_t busy_until = 0;
+
+    void queue_answer(const std::string &data, const uint32_t delay)
+    {
+      uint32_t due = millis() + delay;
+      for (const char c : data)
+      {
+        if (!answer.empty() && due <= answer.back().first)
+        {
+          due = answer.back().first + 1;
+        }
+        answer.push_back(std::make_pair(due, c));
+      }
+    }
+
+    void handle(const std::string &command)
+    {
+      const uint32_t now = millis();
+      const bool busy = now < busy_until;
+      commands.push_back({now, command, busy});
+      if (busy || silent_commands.find(command[0]) != std::string::npos)
+      {
+        return;
+      }
+
+      static const char VERSION[] = "v  MAGELLAN  Version 6.60  3Dconnexion GmbH 05/11/01\r";
+      if (command == "vt")
+      {
+        // answers already in progress are still sent. the version follows once the reset is done
+        busy_until = now + reset_duration;
+        queue_answer(VERSION, reset_duration);
+      }
+      else if (command == "vQ")
+      {
+        queue_answer(VERSION, answer_delay);
+      }
+      else if (command == "kQ")
+      {
+        queue_answer(keypress_message(0), answer_delay);
+      }
+      else if (command == "mQ")
+      {
+        queue_answer(std::string("m") + mode + "\r", answer_delay);
+      }
+      else if (command.size() == 2 && command[0] == 'm')
+      {
+        mode = command[1];
+        queue_answer(command + "\r", answer_delay);
+      }
+      else if (command[0] == 'q' || command[0] == 'n' || command == "z" || command == "b")
+      {
+        queue_answer(command + "\r", answer_delay);
+      }
+      else
+      {
+        queue_answer("e\r", answer_delay);
+      }
+    }
+  };
+}
@@ -0,0 +1,225 @@
+#pragma once
+/**
+ * minimal Arduino PluggableUSB / USBCore for the host.
+ * everything sent or received goes through native::usb(), so tests can inspect and inject USB traffic
+ */
+#include <Arduino.h>
+#include <deque>
+#include <vector>
+
+#define USB_EP_SIZE 64
+
+#define TRANSFER_PGM 0x80
+#define TRANSFER_RELEASE 0x40
+#define TRANSFER_ZERO 0x20
+
+#define EP_TYPE_INTERRUPT_IN 0xC1
+#define EP_TYPE_INTERRUPT_OUT 0xC0
+
+#define USB_ENDPOINT_DIRECTION_MASK 0x80
+#define USB_ENDPOINT_OUT(addr) (lowByte((addr) | 0x00))
+#define USB_ENDPOINT_IN(addr) (lowByte((addr) | 0x80))
+#define USB_ENDPOINT_TYPE_INTERRUPT 0x03
+
+#define USB_DEVICE_CLASS_HUMAN_INTERFACE 0x03
+
+#define REQUEST_DEVICETOHOST 0x80
+#define REQUEST_HOSTTODEVICE 0x00
+#define REQUEST_STANDARD 0x00
+#define REQUEST_CLASS 0x20
+#define REQUEST_INTERFACE 0x01
+#define REQUEST_DEVICETOHOST_CLASS_INTERFACE (REQUEST_DEVICETOHOST | REQUEST_CLASS | REQUEST_INTERFACE)
+#define REQUEST_HOSTTODEVICE_CLASS_INTERFACE (REQUEST_HOSTTODEVICE | REQUEST_CLASS | REQUEST_INTERFACE)
+#define REQUEST_DEVICETOHOST_STANDARD_INTERFACE (REQUEST_DEVICETOHOST | REQUEST_STANDARD | REQUEST_INTERFACE)
+
+typedef struct
+{
+  uint8_t bmRequestType;
+  uint8_t bRequest;
+  uint8_t wValueL;
+  uint8_t wValueH;
+  uint16_t wIndex;
+  uint16_t wLength;
+} USBSetup;
+
+typedef struct __attribute__((packed))
+{
+  uint8_t len;
+  uint8_t dtype;
+  uint8_t number;
+  uint8_t alternate;
+  uint8_t numEndpoints;
+  uint8_t interfaceClass;
+  uint8_t interfaceSubClass;
+  uint8_t protocol;
+  uint8_t iInterface;
+} InterfaceDescriptor;
+
+typedef struct __attribute__((packed))
+{
+  uint8_t len;
+  uint8_t dtype;
+  uint8_t addr;
+  uint8_t attr;
+  uint16_t packetSize;
+  uint8_t interval;
+} EndpointDescriptor;
+
+#define D_INTERFACE(_n, _numEndpoints, _class, _subClass, _protocol) \
+  {                                                                  \
+    9, 4, _n, 0, _numEndpoints, _class, _subClass, _protocol, 0      \
+  }
+
+#define D_ENDPOINT(_addr, _attr, _packetSize, _interval) \
+  {                                                      \
+    7, 5, _addr, _attr, _packetSize, _interval           \
+  }
+
+namespace native
+{
+  /**
+   * recorded USB traffic
+   */
+  struct usb_t
+  {
+    /**
+     * IN transfers completed with TRANSFER_RELEASE, one entry per transfer
+     */
+    std::vector<std::vector<uint8_t>> sent;
+
+    /**
+     * millis() at the time each transfer in sent was released
+     */
+    std::vector<uint32_t> sent_millis;
+
+    /**
+     * bytes written to the IN endpoint since the last TRANSFER_RELEASE
+     */
+    std::vector<uint8_t> pending;
+
+    /**
+     * number of USB_Send() calls
+     */
+    uint32_t send_calls = 0;
+
+    /**
+     * data of the last control transfer
+     */
+    std::vector<uint8_t> control;
+
+    /**
+     * data the host wrote to the OUT endpoint, read by USB_Recv()
+     */
+    std::deque<uint8_t> received;
+
+    void clear()
+    {
+      sent.clear();
+      sent_millis.clear();
+      pending.clear();
+      send_calls = 0;
+      control.clear();
+      received.clear();
+    }
+  };
+
+  inline usb_t &usb()
+  {
+    static usb_t usb;
+    return usb;
+  }
+}
+
+inline int USB_Send(uint8_t ep, const void *data, int len)
+{
+  native::usb_t &usb = native::usb();
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  usb.send_calls++;
+  usb.pending.insert(usb.pending.end(), bytes, bytes + len);
+  if ((ep & TRANSFER_RELEASE) != 0)
+  {
+    usb.sent.push_back(usb.pending);
+    usb.sent_millis.push_back(millis());
+    usb.pending.clear();
+  }
+  return len;
+}
+
+inline int USB_SendControl(uint8_t flags, const void *data, int len)
+{
+  (void)flags;
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  native::usb().control.assign(bytes, bytes + len);
+  return len;
+}
+
+inline int USB_RecvControl(void *data, int len)
+{
+  memset(data, 0, len);
+  return len;
+}
+
+inline uint8_t USB_Available(uint8_t ep)
+{
+  (void)ep;
+  return native::usb().received.size();
+}
+
+inline int USB_Recv(uint8_t ep, void *data, int len)
+{
+  (void)ep;
+  native::usb_t &usb = native::usb();
+  uint8_t *bytes = static_cast<uint8_t *>(data);
+  int n = 0;
+  for (; n < len && !usb.received.empty(); n++)
+  {
+    bytes[n] = usb.received.front();
+    usb.received.pop_front();
+  }
+  return n;
+}
+
+class PluggableUSBModule
+{
+public:
+  PluggableUSBModule(uint8_t numEps, uint8_t numIfs, uint8_t *epType)
+      : numEndpoints(numEps), numInterfaces(numIfs), endpointType(epType) {}
+  virtual ~PluggableUSBModule() {}
+
+protected:
+  virtual bool setup(USBSetup &setup) = 0;
+  virtual int getInterface(uint8_t *interfaceCount) = 0;
+  virtual int getDescriptor(USBSetup &setup) = 0;
+  virtual uint8_t getShortName(char *name)
+  {
+    name[0] = 'A' + pluggedInterface;
+    return 1;
+  }
+
+  uint8_t pluggedInterface = 0;
+  uint8_t pluggedEndpoint = 1;
+
+  const uint8_t numEndpoints;
+  const uint8_t numInterfaces;
+  const uint8_t *endpointType;
+
+  PluggableUSBModule *next = nullptr;
+
+  friend class PluggableUSB_;
+};
+
+class PluggableUSB_
+{
+public:
+  bool plug(PluggableUSBModule *node)
+  {
+    (void)node;
+    return true;
+  }
+};
+
+inline PluggableUSB_ &PluggableUSB()
+{
+  static PluggableUSB_ instance;
+  return instance;
+}
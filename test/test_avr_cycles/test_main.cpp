@@ -0,0 +1,186 @@
+/**
+ * AVR cycle counts of the axis normalization, before and after the integer data path.
+ * runs on the ATmega32u4 in the simavr simulator, see env:micro_cycles in platformio.ini.
+ * run with `pio test -e micro_cycles -v` to see the results
+ *
+ * @note
+ * cycles are counted with Timer1 running at the CPU clock, with interrupts disabled.
+ * so they are exact, both in the simulator and on hardware
+ */
+#include <Arduino.h>
+#include <avr/sleep.h>
+#include <unity.h>
+#include "magellan/MagellanParser.hpp"
+
+using namespace magellan_internal;
+
+/**
+ * calibration and signs of main.cpp
+ */
+typedef axis_pipeline_t<
+    axis_map_t<AXIS_X, -3775, 2173, 1>,
+    axis_map_t<AXIS_Y, -3900, 4037, 1>,
+    axis_map_t<AXIS_Z, -1682, 3122, -1>,
+    axis_map_t<AXIS_U, -2466, 3537, 1>,
+    axis_map_t<AXIS_V, -3939, 2002, 1>,
+    axis_map_t<AXIS_W, -3839, 1691, -1>>
+    main_pipeline;
+
+static const axis_bounds_t main_calibration[6] = {{-3775, 2173}, {-3900, 4037}, {-1682, 3122}, {-2466, 3537}, {-3939, 2002}, {-3839, 1691}};
+
+/**
+ * the SCALE getter of the parser before the integer path: a float division and constrain() on every call
+ */
+static float float_scale(const int16_t value, const axis_bounds_t &cal)
+{
+  return constrain(
+      (value > 0) ? (value / static_cast<float>(cal.max)) : (value < 0) ? (value / -(static_cast<float>(cal.min))) : 0.0f,
+      -1.0f, 1.0f);
+}
+
+/**
+ * map_normal_float() of HIDSpaceMouse before the integer path, for the +-800 range
+ */
+static int16_t float_to_counts(const float value)
+{
+  const int16_t range[2] = {-800, 800};
+  const int16_t span = range[1] - range[0];
+  return range[0] + (value + 1.0f) * span / 2;
+}
+
+/**
+ * raw position frames
+ */
+static const uint8_t FRAME_COUNT = 32;
+static axis_values_t<int16_t> frames[FRAME_COUNT];
+
+/**
+ * keeps the measured results alive, so the compiler cannot drop the work
+ */
+static volatile int16_t sink;
+
+/**
+ * count the CPU cycles of a function, without the cost of the measurement itself
+ */
+template <typename Fn>
+static uint16_t count_cycles(Fn fn)
+{
+  noInterrupts();
+  TCCR1A = 0;
+  TCCR1B = _BV(CS10); // no prescaler, one count per cycle
+  TCNT1 = 0;
+  fn();
+  const uint16_t cycles = TCNT1;
+  TCCR1B = 0;
+  interrupts();
+  return cycles;
+}
+
+static uint16_t measurement_overhead()
+{
+  return count_cycles([]() {});
+}
+
+static void report(const char *name, const uint32_t before, const uint32_t after)
+{
+  char message[96];
+  snprintf(message, sizeof(message), "%s: before %lu cycles, after %lu cycles", name, static_cast<unsigned long>(before), static_cast<unsigned long>(after));
+  TEST_MESSAGE(message);
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+void test_cycles_per_axis()
+{
+  // one axis: the float getter against one axis of the pipeline
+  const uint16_t overhead = measurement_overhead();
+  uint32_t before = 0;
+  uint32_t after = 0;
+  for (uint8_t i = 0; i < FRAME_COUNT; i++)
+  {
+    const axis_values_t<int16_t> &raw = frames[i];
+    before += count_cycles([&]() { sink = float_to_counts(float_scale(raw.x, main_calibration[0])); }) - overhead;
+    after += count_cycles([&]() { sink = axis_map_t<AXIS_X, -3775, 2173, 1>::counts<800>(raw); }) - overhead;
+  }
+
+  report("normalize and map one axis to hid counts, per call", before / FRAME_COUNT, after / FRAME_COUNT);
+  TEST_ASSERT_LESS_THAN_UINT32(before, after);
+}
+
+void test_cycles_per_frame()
+{
+  // per frame before: main.cpp called every getter twice, once for the HID report and once for the debug print.
+  // after: normalized once into the cached Q15 values the getters load, and mapped to hid counts once
+  const uint16_t overhead = measurement_overhead();
+  uint32_t before = 0;
+  uint32_t after = 0;
+  for (uint8_t i = 0; i < FRAME_COUNT; i++)
+  {
+    const axis_values_t<int16_t> &raw = frames[i];
+    int16_t float_counts[6];
+    axis_values_t<int16_t> counts;
+
+    before += count_cycles([&]() {
+      float_counts[0] = float_to_counts(float_scale(raw.x, main_calibration[0]));
+      float_counts[1] = float_to_counts(float_scale(raw.y, main_calibration[1]));
+      float_counts[2] = float_to_counts(-float_scale(raw.z, main_calibration[2]));
+      float_counts[3] = float_to_counts(float_scale(raw.u, main_calibration[3]));
+      float_counts[4] = float_to_counts(float_scale(raw.v, main_calibration[4]));
+      float_counts[5] = float_to_counts(-float_scale(raw.w, main_calibration[5]));
+      sink = float_scale(raw.x, main_calibration[0]) + float_scale(raw.y, main_calibration[1]) + float_scale(raw.z, main_calibration[2])
+             + float_scale(raw.u, main_calibration[3]) + float_scale(raw.v, main_calibration[4]) + float_scale(raw.w, main_calibration[5]);
+    }) - overhead;
+
+    after += count_cycles([&]() {
+      axis_values_t<q15_t> normalized;
+      main_pipeline::apply(raw, normalized);
+      main_pipeline::counts<800, 800>(raw, counts);
+      sink = normalized.x + normalized.y + normalized.z + normalized.u + normalized.v + normalized.w;
+    }) - overhead;
+
+    // the same counts as the float path, with the float library of the AVR
+    const int16_t values[6] = {counts.x, counts.y, counts.z, counts.u, counts.v, counts.w};
+    TEST_ASSERT_EQUAL_INT16_ARRAY(float_counts, values, 6);
+  }
+
+  report("normalize and map all axes, per frame", before / FRAME_COUNT, after / FRAME_COUNT);
+  TEST_ASSERT_LESS_THAN_UINT32(before, after);
+}
+
+void setup()
+{
+  // wait for the test runner, like the PlatformIO examples do on hardware
+  delay(2000);
+
+  // raw values spread over the calibrated range, with some outside of it
+  uint32_t seed = 1;
+  for (uint8_t i = 0; i < FRAME_COUNT; i++)
+  {
+    int16_t *values[6] = {&frames[i].x, &frames[i].y, &frames[i].z, &frames[i].u, &frames[i].v, &frames[i].w};
+    for (uint8_t axis = 0; axis < 6; axis++)
+    {
+      seed = seed * 1103515245 + 12345;
+      *values[axis] = static_cast<int16_t>((seed >> 16) % 8192) - 4096;
+    }
+  }
+
+  UNITY_BEGIN();
+  RUN_TEST(test_cycles_per_axis);
+  RUN_TEST(test_cycles_per_frame);
+  UNITY_END();
+
+  // stop, so the simulator exits
+  noInterrupts();
+  set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+  sleep_mode();
+}
+
+void loop()
+{
+}
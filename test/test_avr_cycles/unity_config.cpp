@@ -0,0 +1,23 @@
+#include <Arduino.h>
+#include "unity_config.h"
+
+void unity_output_start(void)
+{
+  Serial1.begin(115200);
+}
+
+void unity_output_char(int c)
+{
+  Serial1.write(static_cast<uint8_t>(c));
+}
+
+void unity_output_flush(void)
+{
+  Serial1.flush();
+}
+
+void unity_output_complete(void)
+{
+  Serial1.flush();
+  Serial1.end();
+}
@@ -0,0 +1,26 @@
+#ifndef UNITY_CONFIG_H
+#define UNITY_CONFIG_H
+
+/**
+ * unity output on Serial1, since simavr does not simulate the USB serial of the ATmega32u4
+ */
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  void unity_output_start(void);
+  void unity_output_char(int c);
+  void unity_output_flush(void);
+  void unity_output_complete(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define UNITY_OUTPUT_START() unity_output_start()
+#define UNITY_OUTPUT_CHAR(c) unity_output_char(c)
+#define UNITY_OUTPUT_FLUSH() unity_output_flush()
+#define UNITY_OUTPUT_COMPLETE() unity_output_complete()
+
+#endif
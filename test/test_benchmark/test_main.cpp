@@ -0,0 +1,256 @@
+/**
+ * host benchmarks of hot paths, measured on the code that ships.
+ * run with `pio test -e native -f test_benchmark -v` to see the results.
+ *
+ * @note
+ * the numbers are host nanoseconds. they show relative cost, not AVR cycles. see test_avr_cycles for those.
+ * @note
+ * MagellanParser is driven through MagellanSerial::receive(), like the RX ISR does.
+ * the switch decoder it replaced is kept as a reference, and must decode the same values
+ * @note
+ * HIDSpaceMouse is measured through the USB_Send() of the native PluggableUSB, so its numbers include recording the traffic
+ */
+#include <unity.h>
+#include <chrono>
+#include "FakeMagellan.hpp"
+#include "spacemouse/HIDSpaceMouse.hpp"
+
+using namespace magellan_internal;
+
+/**
+ * keeps the benchmarked results alive, so the compiler cannot drop the work
+ */
+static volatile uint32_t sink;
+
+/**
+ * measure the time per call of a function
+ * @param fn the function to measure. called repeatedly
+ * @param iterations calls per run
+ * @return nanoseconds per call, best of several runs
+ */
+template <typename Fn>
+static double measure(Fn fn, const uint32_t iterations)
+{
+  double best = 1e30;
+  for (uint8_t run = 0; run < 5; run++)
+  {
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+      fn(i);
+    }
+    const auto end = std::chrono::steady_clock::now();
+
+    const double ns = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+    if (ns < best)
+    {
+      best = ns;
+    }
+  }
+  return best;
+}
+
+static void report_cost(const char *name, const double cost)
+{
+  char message[128];
+  snprintf(message, sizeof(message), "%s: %.1f ns", name, cost);
+  TEST_MESSAGE(message);
+}
+
+// -----------------------------------------------------------------------------
+// nibble decoding
+// -----------------------------------------------------------------------------
+
+/**
+ * nibble decoder before the lookup table, without the logging of unknown characters
+ */
+static uint8_t switch_decode_nibble(const char c)
+{
+  switch (c)
+  {
+    case '0': return 0;
+    case 'A': return 1;
+    case 'B': return 2;
+    case '3': return 3;
+    case 'D': return 4;
+    case '5': return 5;
+    case '6': return 6;
+    case 'G': return 7;
+    case 'H': return 8;
+    case '9': return 9;
+    case ':': return 10;
+    case 'K': return 11;
+    case '<': return 12;
+    case 'M': return 13;
+    case 'N': return 14;
+    case '?': return 15;
+    default: return 0;
+  }
+}
+
+/**
+ * decode a position payload like before the lookup table: four nibbles per word, decoded after the message is complete
+ */
+static uint32_t switch_decode_payload(const char *payload)
+{
+  uint32_t sum = 0;
+  for (uint8_t word = 0; word < 6; word++)
+  {
+    const char *buffer = &payload[word * 4];
+    const uint8_t n0 = switch_decode_nibble(buffer[0]);
+    const uint8_t n1 = switch_decode_nibble(buffer[1]);
+    const uint8_t n2 = switch_decode_nibble(buffer[2]);
+    const uint8_t n3 = switch_decode_nibble(buffer[3]);
+
+    int16_t value = static_cast<int16_t>(n1 << 8 | n2 << 4 | n3);
+    if ((n0 & 0x08) == 0)
+    {
+      value = -(4096 - value);
+    }
+    sum += static_cast<uint16_t>(value);
+  }
+  return sum;
+}
+
+/**
+ * position payloads with pseudo-random words
+ */
+static char payloads[256][24];
+
+/**
+ * the same payloads, as complete position messages
+ */
+static std::string messages[256];
+
+/**
+ * the real parser, reading from the real ring buffer
+ */
+static MagellanSerial *serial;
+static MagellanParser *parser;
+
+/**
+ * receive a position message and decode it, like the firmware does: the bytes go through receive(), update() parses them
+ * @return the decoded words, summed like switch_decode_payload()
+ */
+static uint32_t parse_message(const std::string &message)
+{
+  fake_magellan::receive(*serial, message);
+  parser->update();
+
+  const axis_values_t<int16_t> raw = parser->get_raw();
+  return static_cast<uint32_t>(static_cast<uint16_t>(raw.x)) + static_cast<uint16_t>(raw.y) + static_cast<uint16_t>(raw.z)
+         + static_cast<uint16_t>(raw.u) + static_cast<uint16_t>(raw.v) + static_cast<uint16_t>(raw.w);
+}
+
+// -----------------------------------------------------------------------------
+// HID report encoding and sending
+// -----------------------------------------------------------------------------
+
+/**
+ * the real HIDSpaceMouse, sending through the USB_Send() of the native PluggableUSB
+ */
+static HIDSpaceMouse *mouse;
+
+/**
+ * the next report slot: update() sends the pending report
+ */
+static void send_slot()
+{
+  native::advance_millis(hid_space_mouse_internal::HID_REPORT_RATE);
+  mouse->update();
+
+  // keep the recorded traffic small, so it does not grow during the benchmark
+  if (native::usb().sent.size() >= 1024)
+  {
+    native::usb().clear();
+  }
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+void test_benchmark_nibble_decode()
+{
+  MagellanSerial magellan_serial;
+  MagellanParser magellan_parser(&fake_magellan::identity_pipeline::apply);
+  magellan_serial.begin(BAUD_RATE);
+  magellan_parser.begin(&magellan_serial);
+  serial = &magellan_serial;
+  parser = &magellan_parser;
+
+  uint32_t seed = 1;
+  for (uint16_t p = 0; p < 256; p++)
+  {
+    for (uint8_t i = 0; i < 24; i++)
+    {
+      seed = seed * 1103515245 + 12345;
+      payloads[p][i] = NIBBLE_CHARS[(seed >> 16) & 0x0F];
+    }
+    messages[p] = "d" + std::string(payloads[p], 24) + "\r";
+
+    TEST_ASSERT_EQUAL_UINT32(switch_decode_payload(payloads[p]), parse_message(messages[p]));
+  }
+  TEST_ASSERT_EQUAL(0, parser->get_link_stats().frames_lost);
+  TEST_ASSERT_EQUAL(0, parser->get_link_stats().decode_errors);
+
+  // the parser also buffers, frames and applies the message, so the two are not a ratio.
+  // the switch decoder is the reference for the decoding alone
+  double cost = measure([](const uint32_t i) { sink += switch_decode_payload(payloads[i & 0xFF]); }, 200000);
+  report_cost("decode a 24 character position payload with the switch decoder", cost);
+
+  cost = measure([](const uint32_t i) { sink += parse_message(messages[i & 0xFF]); }, 200000);
+  report_cost("receive and parse a position message with MagellanParser", cost);
+
+  TEST_ASSERT_EQUAL(0, parser->get_link_stats().frames_lost);
+  TEST_ASSERT_EQUAL(0, serial->get_overruns());
+  serial = nullptr;
+  parser = nullptr;
+}
+
+void test_benchmark_report_send()
+{
+  native::usb().clear();
+  HIDSpaceMouse space_mouse;
+  mouse = &space_mouse;
+
+  // every slot sends one report, in a single USB_Send()
+  for (uint8_t i = 0; i < 16; i++)
+  {
+    mouse->set_button(HIDSpaceMouse::ONE, (i & 1) == 0);
+    send_slot();
+    mouse->set_translation((i & 1) == 0 ? 16000 : -16000, 0, 0);
+    send_slot();
+  }
+  TEST_ASSERT_EQUAL(32, native::usb().sent.size());
+  TEST_ASSERT_EQUAL_UINT32(32, native::usb().send_calls);
+
+  double cost = measure([](const uint32_t i) {
+    mouse->set_button(HIDSpaceMouse::ONE, (i & 1) == 0);
+    send_slot();
+  }, 200000);
+  report_cost("set a button, encode and send the button report", cost);
+
+  cost = measure([](const uint32_t i) {
+    mouse->set_translation((i & 1) == 0 ? 16000 : -16000, 0, 0);
+    send_slot();
+  }, 200000);
+  report_cost("set the translation, encode and send the translation report", cost);
+
+  // nothing changed, so update() sends nothing
+  cost = measure([](const uint32_t) { send_slot(); }, 200000);
+  report_cost("update without a change", cost);
+  mouse = nullptr;
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_benchmark_nibble_decode);
+  RUN_TEST(test_benchmark_report_send);
+  return UNITY_END();
+}
@@ -0,0 +1,166 @@
+#include <unity.h>
+#include "FakeMagellan.hpp"
+#include "FakeHost.hpp"
+
+using namespace magellan_internal;
+using namespace fake_magellan;
+
+static MagellanSerial serial;
+static MagellanParser parser(&identity_pipeline::apply);
+
+void setUp()
+{
+  native::usb().clear();
+  serial.begin(BAUD_RATE);
+  parser = MagellanParser(&identity_pipeline::apply);
+  parser.begin(&serial);
+}
+
+void tearDown()
+{
+}
+
+static void assert_edge(ButtonEdgeQueue<BUTTON_EDGE_QUEUE_SIZE> &edges, const uint8_t button, const bool pressed)
+{
+  button_edge_t edge;
+  TEST_ASSERT_TRUE(edges.pop(edge));
+  TEST_ASSERT_EQUAL_UINT8(button, edge.button);
+  TEST_ASSERT_EQUAL(pressed, edge.pressed);
+}
+
+/**
+ * the button report with only the given buttons pressed
+ */
+static std::vector<uint8_t> button_report(const uint32_t buttons)
+{
+  std::vector<uint8_t> report = {hid_space_mouse_internal::BUTTON_REPORT_ID};
+  for (uint8_t i = 0; i < hid_space_mouse_internal::BUTTON_REPORT_SIZE; i++)
+  {
+    report.push_back(static_cast<uint8_t>(buttons >> (i * 8)));
+  }
+  return report;
+}
+
+void test_queue_keeps_order_across_wrap()
+{
+  ButtonEdgeQueue<4> queue;
+  button_edge_t edge;
+
+  // more edges than slots in total, so head and tail wrap around
+  for (uint8_t i = 0; i < 10; i++)
+  {
+    TEST_ASSERT_TRUE(queue.push({i, i, (i & 1) != 0}));
+    TEST_ASSERT_TRUE(queue.pop(edge));
+    TEST_ASSERT_EQUAL_UINT8(i, edge.button);
+    TEST_ASSERT_EQUAL_UINT32(i, edge.timestamp);
+  }
+  TEST_ASSERT_TRUE(queue.empty());
+  TEST_ASSERT_FALSE(queue.pop(edge));
+}
+
+void test_queue_full_drops_and_counts()
+{
+  ButtonEdgeQueue<4> queue;
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    TEST_ASSERT_TRUE(queue.push({0, i, true}));
+  }
+
+  TEST_ASSERT_FALSE(queue.push({0, 3, true}));
+  TEST_ASSERT_FALSE(queue.push({0, 4, true}));
+  TEST_ASSERT_EQUAL_UINT16(2, queue.get_overflows());
+
+  // the queued edges are kept, the dropped ones are not
+  button_edge_t edge;
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    TEST_ASSERT_TRUE(queue.pop(edge));
+    TEST_ASSERT_EQUAL_UINT8(i, edge.button);
+  }
+  TEST_ASSERT_TRUE(queue.empty());
+}
+
+void test_parser_queues_short_press_within_one_update()
+{
+  // pressed and released before update() runs
+  receive(serial, keypress_message(0x001));
+  receive(serial, keypress_message(0x000));
+  parser.update();
+
+  // the state did not change, but both edges are queued
+  TEST_ASSERT_EQUAL_HEX16(0x000, parser.get_buttons());
+  ButtonEdgeQueue<BUTTON_EDGE_QUEUE_SIZE> &edges = parser.get_button_edges();
+  assert_edge(edges, 0, true);
+  assert_edge(edges, 0, false);
+  TEST_ASSERT_TRUE(edges.empty());
+}
+
+void test_parser_queues_every_changed_button()
+{
+  receive(serial, keypress_message(0x001));
+  parser.update();
+  parser.get_button_edges().clear();
+
+  // button 0 released, buttons 2 and 8 pressed, in one message
+  receive(serial, keypress_message(0x104));
+  parser.update();
+
+  ButtonEdgeQueue<BUTTON_EDGE_QUEUE_SIZE> &edges = parser.get_button_edges();
+  assert_edge(edges, 0, false);
+  assert_edge(edges, 2, true);
+  assert_edge(edges, 8, true);
+  TEST_ASSERT_TRUE(edges.empty());
+}
+
+void test_hid_sends_short_press_as_two_reports()
+{
+  fake_host::SpaceMouse mouse;
+
+  // pressed and released between two reports
+  mouse.set_button(HIDSpaceMouse::ONE, true);
+  mouse.set_button(HIDSpaceMouse::ONE, false);
+  fake_host::run_slots(mouse, 4);
+
+  const std::vector<uint8_t> pressed = button_report(1ul << HIDSpaceMouse::ONE);
+  const std::vector<uint8_t> released = button_report(0);
+  TEST_ASSERT_EQUAL(2, native::usb().sent.size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(pressed.data(), native::usb().sent[0].data(), pressed.size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(released.data(), native::usb().sent[1].data(), released.size());
+
+  // in consecutive report slots
+  TEST_ASSERT_EQUAL_UINT32(hid_space_mouse_internal::HID_REPORT_RATE, native::usb().sent_millis[1] - native::usb().sent_millis[0]);
+}
+
+void test_hid_sends_current_state_after_overflow()
+{
+  fake_host::SpaceMouse mouse;
+
+  // more toggles than the queue holds. the last queued edge is a press, but the button ends up released
+  const uint8_t toggles = hid_space_mouse_internal::BUTTON_EDGE_QUEUE_SIZE + 4;
+  for (uint8_t i = 0; i < toggles; i++)
+  {
+    mouse.set_button(HIDSpaceMouse::TWO, (i & 1) == 0);
+  }
+  TEST_ASSERT_EQUAL_UINT16(toggles - (hid_space_mouse_internal::BUTTON_EDGE_QUEUE_SIZE - 1), mouse.get_button_edge_overflows());
+
+  fake_host::run_slots(mouse, toggles);
+
+  // every queued edge, then the current state once. nothing after that
+  TEST_ASSERT_EQUAL(hid_space_mouse_internal::BUTTON_EDGE_QUEUE_SIZE, native::usb().sent.size());
+  const std::vector<uint8_t> pressed = button_report(1ul << HIDSpaceMouse::TWO);
+  const std::vector<uint8_t> released = button_report(0);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(pressed.data(), native::usb().sent[native::usb().sent.size() - 2].data(), pressed.size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(released.data(), native::usb().sent.back().data(), released.size());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_queue_keeps_order_across_wrap);
+  RUN_TEST(test_queue_full_drops_and_counts);
+  RUN_TEST(test_parser_queues_short_press_within_one_update);
+  RUN_TEST(test_parser_queues_every_changed_button);
+  RUN_TEST(test_hid_sends_short_press_as_two_reports);
+  RUN_TEST(test_hid_sends_current_state_after_overflow);
+  return UNITY_END();
+}
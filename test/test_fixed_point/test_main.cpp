@@ -0,0 +1,252 @@
+#include <unity.h>
+#include "FixedPoint.hpp"
+#include "magellan/AxisPipeline.hpp"
+
+using namespace magellan_internal;
+
+/**
+ * a / b, rounded to nearest with ties away from zero, saturated to [Q15_MIN, Q15_MAX]
+ */
+static int32_t reference_round(const int64_t a, const int64_t b)
+{
+  const bool negative = (a < 0) != (b < 0);
+  const int64_t na = a < 0 ? -a : a;
+  const int64_t nb = b < 0 ? -b : b;
+  int64_t q = (na * 2 + nb) / (nb * 2);
+  if (q > Q15_MAX)
+  {
+    q = Q15_MAX;
+  }
+  return negative ? -q : q;
+}
+
+/**
+ * fnv-1a hash over 16 bit values, to pin a large set of results
+ */
+struct result_hash_t
+{
+  uint32_t hash = 2166136261u;
+
+  void add(const int16_t value)
+  {
+    const uint16_t v = static_cast<uint16_t>(value);
+    hash = (hash ^ (v & 0xFF)) * 16777619u;
+    hash = (hash ^ (v >> 8)) * 16777619u;
+  }
+};
+
+// calibration and signs of src/main.cpp
+typedef axis_pipeline_t<
+    axis_map_t<AXIS_X, -3775, 2173, 1>,
+    axis_map_t<AXIS_Y, -3900, 4037, 1>,
+    axis_map_t<AXIS_Z, -1682, 3122, -1>,
+    axis_map_t<AXIS_U, -2466, 3537, 1>,
+    axis_map_t<AXIS_V, -3939, 2002, 1>,
+    axis_map_t<AXIS_W, -3839, 1691, -1>>
+    main_pipeline;
+
+static const int16_t main_calibration[6][2] = {{-3775, 2173}, {-3900, 4037}, {-1682, 3122}, {-2466, 3537}, {-3939, 2002}, {-3839, 1691}};
+static const int8_t main_signs[6] = {1, 1, -1, 1, 1, -1};
+
+/**
+ * the float path that was replaced: normalize, apply the correction factor, then map_normal_float() to +-half_range
+ */
+static int16_t float_path(const int16_t raw, const int16_t min, const int16_t max, const int8_t sign, const int16_t half_range = 800)
+{
+  float value = raw > 0 ? raw / static_cast<float>(max) : raw < 0 ? raw / -static_cast<float>(min) : 0.0f;
+  value = constrain(value, -1.0f, 1.0f);
+  value = value * static_cast<float>(sign);
+
+  const int16_t range[2] = {static_cast<int16_t>(-half_range), half_range};
+  const int16_t span = range[1] - range[0];
+  return range[0] + (value + 1.0f) * span / 2;
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+void test_divide_is_within_one_of_exact_rounding()
+{
+  result_hash_t pinned;
+  for (uint16_t bound = 1; bound <= 4096; bound++)
+  {
+    const uint16_t factor = q15_reciprocal_factor(bound);
+    const uint8_t shift = q15_reciprocal_shift(bound);
+
+    int16_t previous = Q15_MIN;
+    for (int16_t value = -4096; value <= 4096; value++)
+    {
+      const int16_t result = q15_divide(value, factor, shift);
+      const int32_t exact = reference_round(static_cast<int64_t>(value) * Q15_MAX, bound);
+      TEST_ASSERT_INT_WITHIN(1, exact, result);
+
+      // monotonic and symmetric around zero
+      TEST_ASSERT_GREATER_OR_EQUAL(previous, result);
+      TEST_ASSERT_EQUAL_INT16(-result, q15_divide(value, factor, shift, true));
+      TEST_ASSERT_EQUAL_INT16(-result, q15_divide(-value, factor, shift));
+      previous = result;
+      pinned.add(result);
+    }
+
+    // exact at the bound, so full deflection is always Q15_MAX
+    TEST_ASSERT_EQUAL_INT16(Q15_MAX, q15_divide(bound, factor, shift));
+  }
+
+  TEST_ASSERT_EQUAL_HEX32(0xDE11E388, pinned.hash);
+}
+
+void test_multiply_matches_exact_rounding()
+{
+  static const int16_t factors[] = {0, 1, 2, 3, 7, 350, 800, 4096, 16383, 16384, 32766, Q15_MAX};
+  for (const int16_t factor : factors)
+  {
+    for (int32_t value = Q15_MIN; value <= Q15_MAX; value++)
+    {
+      const int32_t exact = reference_round(value * factor, Q15_MAX);
+      TEST_ASSERT_EQUAL_INT16(exact, q15_multiply(value, factor));
+      TEST_ASSERT_EQUAL_INT16(-exact, q15_multiply(value, -factor));
+    }
+  }
+
+  // every factor, for a spread of values
+  uint32_t seed = 1;
+  for (int32_t factor = Q15_MIN; factor <= Q15_MAX; factor++)
+  {
+    for (uint8_t i = 0; i < 16; i++)
+    {
+      seed = seed * 1103515245 + 12345;
+      const int16_t value = static_cast<int16_t>((seed >> 8) % 65535) - Q15_MAX;
+      TEST_ASSERT_EQUAL_INT16(reference_round(static_cast<int32_t>(value) * factor, Q15_MAX), q15_multiply(value, factor));
+    }
+  }
+
+  TEST_ASSERT_EQUAL_INT16(1234, q15_multiply(1234, Q15_MAX));
+  TEST_ASSERT_EQUAL_INT16(-1234, q15_multiply(-1234, Q15_MAX));
+}
+
+void test_scale_truncated_is_exact()
+{
+  static const q15_t scales[] = {800, 4096};
+  for (const q15_t scale : scales)
+  {
+    for (uint16_t bound = 1; bound <= 4096; bound++)
+    {
+      const uint16_t factor = q15_reciprocal_factor(bound, scale);
+      const uint8_t shift = q15_reciprocal_shift(bound, scale);
+      for (uint16_t magnitude = 0; magnitude <= bound; magnitude++)
+      {
+        bool exact;
+        const uint32_t product = static_cast<uint32_t>(magnitude) * scale;
+        TEST_ASSERT_EQUAL_UINT16(product / bound, scale_truncated(magnitude, bound, scale, factor, shift, exact));
+        TEST_ASSERT_EQUAL(product % bound == 0, exact);
+      }
+    }
+  }
+}
+
+/**
+ * compare scale_to_counts() with the float path, for every bound and every value within it
+ */
+template <int16_t RANGE>
+static void assert_counts_match_float_path()
+{
+  for (uint16_t bound = 1; bound <= 4096; bound++)
+  {
+    const uint16_t factor = q15_reciprocal_factor(bound, RANGE);
+    const uint8_t shift = q15_reciprocal_shift(bound, RANGE);
+    for (int16_t value = -static_cast<int16_t>(bound) - 1; value <= static_cast<int16_t>(bound) + 1; value++)
+    {
+      const int16_t min = -static_cast<int16_t>(bound);
+      TEST_ASSERT_EQUAL_INT16(float_path(value, min, bound, 1, RANGE), scale_to_counts<RANGE>(value, bound, factor, shift, false));
+      TEST_ASSERT_EQUAL_INT16(float_path(value, min, bound, -1, RANGE), scale_to_counts<RANGE>(value, bound, factor, shift, true));
+    }
+  }
+}
+
+void test_counts_match_float_path_for_every_bound()
+{
+  assert_counts_match_float_path<FLOAT_PATH_RANGE>();
+}
+
+void test_counts_truncate_at_other_ranges()
+{
+  // e.g. full resolution. there was no float path, and its rounding would not have been a truncation
+  for (uint16_t bound = 1; bound <= 4096; bound++)
+  {
+    const uint16_t factor = q15_reciprocal_factor(bound, 4096);
+    const uint8_t shift = q15_reciprocal_shift(bound, 4096);
+    for (int16_t value = -static_cast<int16_t>(bound); value <= static_cast<int16_t>(bound); value++)
+    {
+      const int16_t exact = static_cast<int32_t>(value) * 4096 / bound;
+      TEST_ASSERT_EQUAL_INT16(exact, scale_to_counts<4096>(value, bound, factor, shift, false));
+      TEST_ASSERT_EQUAL_INT16(-exact, scale_to_counts<4096>(value, bound, factor, shift, true));
+    }
+  }
+}
+
+void test_main_calibration_against_float_path()
+{
+  // hid counts for every raw value, with the calibration of main.cpp
+  result_hash_t pinned;
+  uint32_t differences = 0;
+  for (int16_t raw = -4096; raw <= 4095; raw++)
+  {
+    const axis_values_t<int16_t> raw_values = {raw, raw, raw, raw, raw, raw};
+    axis_values_t<int16_t> counts;
+    main_pipeline::counts<800, 800>(raw_values, counts);
+
+    const int16_t values[6] = {counts.x, counts.y, counts.z, counts.u, counts.v, counts.w};
+    for (uint8_t axis = 0; axis < 6; axis++)
+    {
+      const int16_t reference = float_path(raw, main_calibration[axis][0], main_calibration[axis][1], main_signs[axis]);
+      differences += values[axis] != reference ? 1 : 0;
+      pinned.add(values[axis]);
+    }
+  }
+
+  TEST_ASSERT_EQUAL_UINT32(0, differences);
+  TEST_ASSERT_EQUAL_HEX32(0x98D39524, pinned.hash);
+}
+
+void test_main_calibration_pinned_values()
+{
+  // raw -> hid counts for x (-3775, 2173), as the float path gave them.
+  // -1510 / 3775 is exactly -320 / 800, but the float rounding gave -319
+  static const int16_t raw[] = {0, -1510, -1509, 1085, 1087, -3775, 2173, -4096, 4095};
+  static const int16_t counts[] = {0, -319, -319, 399, 400, -800, 800, -800, 800};
+  for (uint8_t i = 0; i < sizeof(raw) / sizeof(raw[0]); i++)
+  {
+    const axis_values_t<int16_t> raw_values = {raw[i], 0, 0, 0, 0, 0};
+    axis_values_t<int16_t> output;
+    main_pipeline::counts<800, 800>(raw_values, output);
+    TEST_ASSERT_EQUAL_INT16(counts[i], output.x);
+  }
+}
+
+void test_scaled_axis_counts_round()
+{
+  // the float path had no scale, so scaled axes are mapped through Q15 and rounded
+  typedef axis_map_t<AXIS_X, -1000, 1000, 1, Q15_MAX / 2> half;
+  const axis_values_t<int16_t> raw_values = {1000, 0, 0, 0, 0, 0};
+  TEST_ASSERT_EQUAL_INT16(q15_multiply(half::apply(raw_values), 800), half::counts<800>(raw_values));
+  TEST_ASSERT_EQUAL_INT16(400, half::counts<800>(raw_values));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_divide_is_within_one_of_exact_rounding);
+  RUN_TEST(test_multiply_matches_exact_rounding);
+  RUN_TEST(test_scale_truncated_is_exact);
+  RUN_TEST(test_counts_match_float_path_for_every_bound);
+  RUN_TEST(test_counts_truncate_at_other_ranges);
+  RUN_TEST(test_main_calibration_against_float_path);
+  RUN_TEST(test_main_calibration_pinned_values);
+  RUN_TEST(test_scaled_axis_counts_round);
+  return UNITY_END();
+}
@@ -0,0 +1,441 @@
+#include <unity.h>
+#include <map>
+#include "FakeHost.hpp"
+
+using namespace hid_space_mouse_internal;
+using fake_host::append_axis;
+
+/**
+ * what the report descriptor says about an input report
+ */
+struct input_report_t
+{
+  uint16_t bits;
+  int32_t logical_min;
+  int32_t logical_max;
+};
+
+/**
+ * sign-extended value of a short item
+ */
+static int32_t item_value(const uint8_t *data, const uint8_t size)
+{
+  switch (size)
+  {
+  case 1:
+    return static_cast<int8_t>(data[0]);
+  case 2:
+    return static_cast<int16_t>(data[0] | (data[1] << 8));
+  case 4:
+    return static_cast<int32_t>(data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24));
+  default:
+    return 0;
+  }
+}
+
+/**
+ * walk the short items of a report descriptor, and collect the size and logical range of each input report
+ */
+static std::map<uint8_t, input_report_t> parse_input_reports(const std::vector<uint8_t> &descriptor)
+{
+  std::map<uint8_t, input_report_t> reports;
+  uint8_t report_id = 0;
+  uint32_t report_size = 0;
+  uint32_t report_count = 0;
+  int32_t logical_min = 0;
+  int32_t logical_max = 0;
+
+  for (size_t i = 0; i < descriptor.size();)
+  {
+    const uint8_t prefix = descriptor[i];
+    const uint8_t size = (prefix & 0x03) == 3 ? 4 : (prefix & 0x03);
+    TEST_ASSERT_TRUE(i + 1 + size <= descriptor.size());
+    const int32_t value = item_value(&descriptor[i + 1], size);
+
+    switch (prefix & 0xFC)
+    {
+    case 0x84: // Report ID
+      report_id = static_cast<uint8_t>(value);
+      break;
+    case 0x74: // Report Size
+      report_size = static_cast<uint32_t>(value);
+      break;
+    case 0x94: // Report Count
+      report_count = static_cast<uint32_t>(value);
+      break;
+    case 0x14: // Logical Minimum
+      logical_min = value;
+      break;
+    case 0x24: // Logical Maximum
+      logical_max = value;
+      break;
+    case 0x80: // Input
+    {
+      input_report_t &report = reports[report_id];
+      if (report.bits == 0)
+      {
+        report.logical_min = logical_min;
+        report.logical_max = logical_max;
+      }
+      else
+      {
+        // all axes of a report have to share the range, the host applies one scaling
+        TEST_ASSERT_EQUAL_INT(report.logical_min, logical_min);
+        TEST_ASSERT_EQUAL_INT(report.logical_max, logical_max);
+      }
+      report.bits += report_size * report_count;
+      break;
+    }
+    default:
+      break;
+    }
+
+    i += 1 + size;
+  }
+
+  return reports;
+}
+
+/**
+ * the report of an ID that was sent last
+ */
+static std::vector<uint8_t> last_sent(const uint8_t report_id)
+{
+  const std::vector<std::vector<uint8_t>> &sent = native::usb().sent;
+  for (size_t i = sent.size(); i > 0; i--)
+  {
+    if (!sent[i - 1].empty() && sent[i - 1][0] == report_id)
+    {
+      return sent[i - 1];
+    }
+  }
+  return std::vector<uint8_t>();
+}
+
+void setUp()
+{
+  native::usb().clear();
+}
+
+void tearDown()
+{
+}
+
+void test_descriptor_ranges_match_the_range_constants()
+{
+  fake_host::SpaceMouse mouse;
+  const std::map<uint8_t, input_report_t> reports = parse_input_reports(fake_host::report_descriptor(mouse));
+
+#if HID_SPACE_MOUSE_COMBINED_REPORT
+  TEST_ASSERT_EQUAL(1, reports.count(MOTION_REPORT_ID));
+  TEST_ASSERT_EQUAL(0, reports.count(ROTATION_REPORT_ID));
+  TEST_ASSERT_EQUAL_INT(POSITION_RANGE[0], reports.at(MOTION_REPORT_ID).logical_min);
+  TEST_ASSERT_EQUAL_INT(POSITION_RANGE[1], reports.at(MOTION_REPORT_ID).logical_max);
+#else
+  TEST_ASSERT_EQUAL_INT(POSITION_RANGE[0], reports.at(TRANSLATION_REPORT_ID).logical_min);
+  TEST_ASSERT_EQUAL_INT(POSITION_RANGE[1], reports.at(TRANSLATION_REPORT_ID).logical_max);
+  TEST_ASSERT_EQUAL_INT(ROTATION_RANGE[0], reports.at(ROTATION_REPORT_ID).logical_min);
+  TEST_ASSERT_EQUAL_INT(ROTATION_RANGE[1], reports.at(ROTATION_REPORT_ID).logical_max);
+#endif
+  TEST_ASSERT_EQUAL(BUTTON_COUNT, reports.at(BUTTON_REPORT_ID).bits);
+}
+
+void test_sent_reports_match_the_descriptor()
+{
+  fake_host::SpaceMouse mouse;
+  const std::map<uint8_t, input_report_t> reports = parse_input_reports(fake_host::report_descriptor(mouse));
+
+  mouse.set_translation(1000, 2000, 3000);
+  mouse.set_rotation(4000, 5000, 6000);
+  mouse.set_button(HIDSpaceMouse::MENU, true);
+  fake_host::run_slots(mouse, 4);
+
+  // every sent report is the report ID plus exactly the bits the descriptor declares for it
+  TEST_ASSERT_EQUAL(reports.size(), native::usb().sent.size());
+  for (const std::vector<uint8_t> &report : native::usb().sent)
+  {
+    TEST_ASSERT_EQUAL(1, reports.count(report[0]));
+    TEST_ASSERT_EQUAL(1 + reports.at(report[0]).bits / 8, report.size());
+  }
+}
+
+void test_motion_report_bytes()
+{
+  fake_host::SpaceMouse mouse;
+
+  // full deflection, half deflection and rest, on every axis
+  mouse.set_translation(Q15_MAX, Q15_MIN, 0);
+  mouse.set_rotation(16384, -16384, Q15_MAX);
+  fake_host::run_slots(mouse, 2);
+
+#if HID_SPACE_MOUSE_COMBINED_REPORT
+  std::vector<uint8_t> motion = {MOTION_REPORT_ID};
+  append_axis(motion, POSITION_RANGE[1]);
+  append_axis(motion, POSITION_RANGE[0]);
+  append_axis(motion, 0);
+  append_axis(motion, ROTATION_RANGE[1] / 2);
+  append_axis(motion, ROTATION_RANGE[0] / 2);
+  append_axis(motion, ROTATION_RANGE[1]);
+
+  // translation and rotation arrive in the same report, in one slot
+  TEST_ASSERT_EQUAL(1, native::usb().sent.size());
+  TEST_ASSERT_EQUAL(13, native::usb().sent[0].size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(motion.data(), native::usb().sent[0].data(), motion.size());
+#else
+  std::vector<uint8_t> translation = {TRANSLATION_REPORT_ID};
+  append_axis(translation, POSITION_RANGE[1]);
+  append_axis(translation, POSITION_RANGE[0]);
+  append_axis(translation, 0);
+
+  std::vector<uint8_t> rotation = {ROTATION_REPORT_ID};
+  append_axis(rotation, ROTATION_RANGE[1] / 2);
+  append_axis(rotation, ROTATION_RANGE[0] / 2);
+  append_axis(rotation, ROTATION_RANGE[1]);
+
+  TEST_ASSERT_EQUAL(2, native::usb().sent.size());
+  TEST_ASSERT_EQUAL(7, native::usb().sent[0].size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(translation.data(), native::usb().sent[0].data(), translation.size());
+  TEST_ASSERT_EQUAL(7, native::usb().sent[1].size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(rotation.data(), native::usb().sent[1].data(), rotation.size());
+#endif
+}
+
+void test_motion_report_carries_latest_of_both_parts()
+{
+  fake_host::SpaceMouse mouse;
+
+  mouse.set_translation(Q15_MAX, 0, 0);
+  mouse.set_rotation(0, 0, Q15_MIN);
+  fake_host::run_slots(mouse, 2);
+  native::usb().clear();
+
+  // only the translation changes. the rotation bytes have to stay what was sent before
+  mouse.set_translation(0, Q15_MAX, 0);
+  fake_host::run_slots(mouse, 2);
+
+  std::vector<uint8_t> translation;
+  append_axis(translation, 0);
+  append_axis(translation, POSITION_RANGE[1]);
+  append_axis(translation, 0);
+
+  std::vector<uint8_t> rotation;
+  append_axis(rotation, 0);
+  append_axis(rotation, 0);
+  append_axis(rotation, ROTATION_RANGE[0]);
+
+  TEST_ASSERT_EQUAL(1, native::usb().sent.size());
+#if HID_SPACE_MOUSE_COMBINED_REPORT
+  const std::vector<uint8_t> motion = last_sent(MOTION_REPORT_ID);
+  TEST_ASSERT_EQUAL(13, motion.size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(translation.data(), &motion[1], 6);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(rotation.data(), &motion[7], 6);
+#else
+  const std::vector<uint8_t> report = last_sent(TRANSLATION_REPORT_ID);
+  TEST_ASSERT_EQUAL(7, report.size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(translation.data(), &report[1], 6);
+#endif
+}
+
+void test_get_report_returns_current_input_reports()
+{
+  fake_host::SpaceMouse mouse;
+  mouse.set_translation(Q15_MAX, 0, Q15_MIN);
+  mouse.set_rotation(0, Q15_MAX, 0);
+  mouse.set_button(HIDSpaceMouse::MENU, true);
+  mouse.set_button(HIDSpaceMouse::CONTROL, true);
+
+  // answered from the current state, before anything was sent
+  TEST_ASSERT_EQUAL(0, native::usb().sent.size());
+
+  std::vector<uint8_t> translation;
+  append_axis(translation, POSITION_RANGE[1]);
+  append_axis(translation, 0);
+  append_axis(translation, POSITION_RANGE[0]);
+  std::vector<uint8_t> rotation;
+  append_axis(rotation, 0);
+  append_axis(rotation, ROTATION_RANGE[1]);
+  append_axis(rotation, 0);
+
+#if HID_SPACE_MOUSE_COMBINED_REPORT
+  const std::vector<uint8_t> motion = fake_host::control_in(mouse, HID_GET_REPORT, HID_REPORT_TYPE_INPUT, MOTION_REPORT_ID);
+  TEST_ASSERT_EQUAL(13, motion.size());
+  TEST_ASSERT_EQUAL_UINT8(MOTION_REPORT_ID, motion[0]);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(translation.data(), &motion[1], 6);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(rotation.data(), &motion[7], 6);
+  TEST_ASSERT_EQUAL(0, fake_host::control_in(mouse, HID_GET_REPORT, HID_REPORT_TYPE_INPUT, ROTATION_REPORT_ID).size());
+#else
+  const std::vector<uint8_t> translation_report = fake_host::control_in(mouse, HID_GET_REPORT, HID_REPORT_TYPE_INPUT, TRANSLATION_REPORT_ID);
+  TEST_ASSERT_EQUAL(7, translation_report.size());
+  TEST_ASSERT_EQUAL_UINT8(TRANSLATION_REPORT_ID, translation_report[0]);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(translation.data(), &translation_report[1], 6);
+
+  const std::vector<uint8_t> rotation_report = fake_host::control_in(mouse, HID_GET_REPORT, HID_REPORT_TYPE_INPUT, ROTATION_REPORT_ID);
+  TEST_ASSERT_EQUAL(7, rotation_report.size());
+  TEST_ASSERT_EQUAL_UINT8(ROTATION_REPORT_ID, rotation_report[0]);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(rotation.data(), &rotation_report[1], 6);
+#endif
+
+  const uint32_t buttons = (1ul << HIDSpaceMouse::MENU) | (1ul << HIDSpaceMouse::CONTROL);
+  const std::vector<uint8_t> expected_buttons = {BUTTON_REPORT_ID, static_cast<uint8_t>(buttons), static_cast<uint8_t>(buttons >> 8), static_cast<uint8_t>(buttons >> 16), static_cast<uint8_t>(buttons >> 24)};
+  const std::vector<uint8_t> button_report = fake_host::control_in(mouse, HID_GET_REPORT, HID_REPORT_TYPE_INPUT, BUTTON_REPORT_ID);
+  TEST_ASSERT_EQUAL(expected_buttons.size(), button_report.size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected_buttons.data(), button_report.data(), expected_buttons.size());
+
+  // and the sent reports are the same bytes
+  fake_host::run_slots(mouse, 8);
+  const std::vector<uint8_t> sent_buttons = last_sent(BUTTON_REPORT_ID);
+  TEST_ASSERT_EQUAL(expected_buttons.size(), sent_buttons.size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected_buttons.data(), sent_buttons.data(), expected_buttons.size());
+}
+
+void test_get_report_is_cut_to_length()
+{
+  fake_host::SpaceMouse mouse;
+  mouse.set_button(HIDSpaceMouse::MENU, true);
+
+  const std::vector<uint8_t> report = fake_host::control_in(mouse, HID_GET_REPORT, HID_REPORT_TYPE_INPUT, BUTTON_REPORT_ID, 2);
+  TEST_ASSERT_EQUAL(2, report.size());
+  TEST_ASSERT_EQUAL_UINT8(BUTTON_REPORT_ID, report[0]);
+  TEST_ASSERT_EQUAL_HEX8(1 << HIDSpaceMouse::MENU, report[1]);
+}
+
+void test_get_report_stalls_unknown_reports()
+{
+  fake_host::SpaceMouse mouse;
+
+  TEST_ASSERT_EQUAL(0, fake_host::control_in(mouse, HID_GET_REPORT, HID_REPORT_TYPE_INPUT, 0).size());
+  TEST_ASSERT_EQUAL(0, fake_host::control_in(mouse, HID_GET_REPORT, HID_REPORT_TYPE_INPUT, LED_REPORT_ID).size());
+  TEST_ASSERT_EQUAL(0, fake_host::control_in(mouse, HID_GET_REPORT, HID_REPORT_TYPE_OUTPUT, LED_REPORT_ID).size());
+  TEST_ASSERT_EQUAL(0, fake_host::control_in(mouse, HID_GET_REPORT, HID_REPORT_TYPE_FEATURE, BUTTON_REPORT_ID).size());
+}
+
+void test_get_protocol_returns_set_protocol()
+{
+  fake_host::SpaceMouse mouse;
+
+  std::vector<uint8_t> protocol = fake_host::control_in(mouse, HID_GET_PROTOCOL, 0, 0);
+  TEST_ASSERT_EQUAL(1, protocol.size());
+  TEST_ASSERT_EQUAL_UINT8(HID_REPORT_PROTOCOL, protocol[0]);
+
+  TEST_ASSERT_TRUE(fake_host::control_out(mouse, HID_SET_PROTOCOL, 0, HID_BOOT_PROTOCOL));
+  TEST_ASSERT_EQUAL_UINT8(HID_BOOT_PROTOCOL, fake_host::control_in(mouse, HID_GET_PROTOCOL, 0, 0)[0]);
+
+  // reading the report descriptor selects the report protocol again
+  fake_host::report_descriptor(mouse);
+  TEST_ASSERT_EQUAL_UINT8(HID_REPORT_PROTOCOL, fake_host::control_in(mouse, HID_GET_PROTOCOL, 0, 0)[0]);
+}
+
+void test_each_report_is_a_single_transfer()
+{
+  fake_host::SpaceMouse mouse;
+  mouse.set_translation(1000, 2000, 3000);
+  mouse.set_rotation(4000, 5000, 6000);
+  mouse.set_button(HIDSpaceMouse::MENU, true);
+  mouse.set_button(HIDSpaceMouse::MENU, false);
+  fake_host::run_slots(mouse, 6);
+
+  // one USB_Send() per report, carrying the ID and the payload
+  TEST_ASSERT_GREATER_THAN(0, native::usb().sent.size());
+  TEST_ASSERT_EQUAL_UINT32(native::usb().sent.size(), native::usb().send_calls);
+  TEST_ASSERT_EQUAL(0, native::usb().pending.size());
+}
+
+void test_button_report_bytes_follow_the_bitmask()
+{
+  fake_host::SpaceMouse mouse;
+
+  // each button alone sets its bit, little-endian
+  for (uint8_t button = 0; button < BUTTON_COUNT; button++)
+  {
+    mouse.set_button(button, true);
+    const std::vector<uint8_t> report = fake_host::control_in(mouse, HID_GET_REPORT, HID_REPORT_TYPE_INPUT, BUTTON_REPORT_ID);
+    for (uint8_t i = 0; i < BUTTON_REPORT_SIZE; i++)
+    {
+      TEST_ASSERT_EQUAL_HEX8(i == button / 8 ? 1 << (button % 8) : 0, report[1 + i]);
+    }
+    mouse.set_button(button, false);
+  }
+
+  // random presses and releases, compared to a bool array of the buttons
+  bool model[BUTTON_COUNT] = {false};
+  uint32_t seed = 1;
+  for (uint16_t step = 0; step < 2000; step++)
+  {
+    seed = seed * 1103515245 + 12345;
+    const uint8_t button = (seed >> 16) % BUTTON_COUNT;
+    const bool pressed = ((seed >> 24) & 1) != 0;
+    mouse.set_button(button, pressed);
+    model[button] = pressed;
+
+    uint8_t expected[BUTTON_REPORT_SIZE] = {0};
+    for (uint8_t i = 0; i < BUTTON_COUNT; i++)
+    {
+      expected[i / 8] |= model[i] ? 1 << (i % 8) : 0;
+    }
+    const std::vector<uint8_t> report = fake_host::control_in(mouse, HID_GET_REPORT, HID_REPORT_TYPE_INPUT, BUTTON_REPORT_ID);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, &report[1], BUTTON_REPORT_SIZE);
+  }
+
+  // set_neutral() releases all of them
+  mouse.set_neutral();
+  const std::vector<uint8_t> report = fake_host::control_in(mouse, HID_GET_REPORT, HID_REPORT_TYPE_INPUT, BUTTON_REPORT_ID);
+  for (uint8_t i = 0; i < BUTTON_REPORT_SIZE; i++)
+  {
+    TEST_ASSERT_EQUAL_HEX8(0, report[1 + i]);
+  }
+}
+
+void test_sent_button_edges_follow_the_bitmask()
+{
+  fake_host::SpaceMouse mouse;
+
+  // the highest and lowest buttons, so every report byte is used
+  mouse.set_button(31, true);
+  mouse.set_button(0, true);
+  mouse.set_button(31, false);
+  fake_host::run_slots(mouse, 5);
+
+  const uint8_t expected[3][1 + BUTTON_REPORT_SIZE] = {
+      {BUTTON_REPORT_ID, 0x00, 0x00, 0x00, 0x80},
+      {BUTTON_REPORT_ID, 0x01, 0x00, 0x00, 0x80},
+      {BUTTON_REPORT_ID, 0x01, 0x00, 0x00, 0x00},
+  };
+  TEST_ASSERT_EQUAL(3, native::usb().sent.size());
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    TEST_ASSERT_EQUAL(sizeof(expected[i]), native::usb().sent[i].size());
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected[i], native::usb().sent[i].data(), sizeof(expected[i]));
+  }
+}
+
+void test_buttons_unique_detects_non_permutations()
+{
+  static constexpr HIDSpaceMouse::KnownButton unique[] = {HIDSpaceMouse::ONE, HIDSpaceMouse::TWO, HIDSpaceMouse::MENU, HIDSpaceMouse::ROTATE};
+  static constexpr HIDSpaceMouse::KnownButton duplicate[] = {HIDSpaceMouse::ONE, HIDSpaceMouse::TWO, HIDSpaceMouse::ONE};
+  static_assert(HIDSpaceMouse::buttons_unique(unique, 4), "usable in a static_assert");
+
+  TEST_ASSERT_TRUE(HIDSpaceMouse::buttons_unique(unique, 4));
+  TEST_ASSERT_FALSE(HIDSpaceMouse::buttons_unique(duplicate, 3));
+  TEST_ASSERT_TRUE(HIDSpaceMouse::buttons_unique(duplicate, 2));
+
+  const HIDSpaceMouse::KnownButton out_of_range[] = {HIDSpaceMouse::ONE, static_cast<HIDSpaceMouse::KnownButton>(BUTTON_COUNT)};
+  TEST_ASSERT_FALSE(HIDSpaceMouse::buttons_unique(out_of_range, 2));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_descriptor_ranges_match_the_range_constants);
+  RUN_TEST(test_sent_reports_match_the_descriptor);
+  RUN_TEST(test_motion_report_bytes);
+  RUN_TEST(test_motion_report_carries_latest_of_both_parts);
+  RUN_TEST(test_get_report_returns_current_input_reports);
+  RUN_TEST(test_get_report_is_cut_to_length);
+  RUN_TEST(test_get_report_stalls_unknown_reports);
+  RUN_TEST(test_get_protocol_returns_set_protocol);
+  RUN_TEST(test_each_report_is_a_single_transfer);
+  RUN_TEST(test_button_report_bytes_follow_the_bitmask);
+  RUN_TEST(test_sent_button_edges_follow_the_bitmask);
+  RUN_TEST(test_buttons_unique_detects_non_permutations);
+  return UNITY_END();
+}
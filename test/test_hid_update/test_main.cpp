@@ -0,0 +1,388 @@
+#include <unity.h>
+#include "FakeHost.hpp"
+
+using namespace hid_space_mouse_internal;
+
+// the reports carrying translation and rotation, in the selected layout
+#if HID_SPACE_MOUSE_COMBINED_REPORT
+static const uint8_t TRANSLATION_ID = MOTION_REPORT_ID;
+static const uint8_t ROTATION_ID = MOTION_REPORT_ID;
+#else
+static const uint8_t TRANSLATION_ID = TRANSLATION_REPORT_ID;
+static const uint8_t ROTATION_ID = ROTATION_REPORT_ID;
+#endif
+
+/**
+ * the Q15 value that quantizes to a number of HID counts
+ */
+static q15_t q15_counts(const int16_t counts, const int16_t range)
+{
+  return static_cast<q15_t>((static_cast<int32_t>(counts) * Q15_MAX + (counts < 0 ? -range / 2 : range / 2)) / range);
+}
+
+void setUp()
+{
+  native::usb().clear();
+}
+
+void tearDown()
+{
+}
+
+void test_nothing_is_sent_without_changes()
+{
+  fake_host::SpaceMouse mouse;
+  fake_host::run_slots(mouse, 10);
+  TEST_ASSERT_EQUAL(0, native::usb().sent.size());
+
+  // setting the values the host already has does not send anything either
+  mouse.set_translation(0, 0, 0);
+  mouse.set_rotation(0, 0, 0);
+  mouse.set_button(HIDSpaceMouse::MENU, false);
+  fake_host::run_slots(mouse, 10);
+  TEST_ASSERT_EQUAL(0, native::usb().sent.size());
+}
+
+void test_only_changed_reports_are_sent()
+{
+  fake_host::SpaceMouse mouse;
+
+  mouse.set_rotation(0, 10000, 0);
+  fake_host::run_slots(mouse, 5);
+  TEST_ASSERT_EQUAL(1, native::usb().sent.size());
+  TEST_ASSERT_EQUAL_UINT8(ROTATION_ID, native::usb().sent[0][0]);
+  native::usb().clear();
+
+  mouse.set_translation(10000, 0, 0);
+  fake_host::run_slots(mouse, 5);
+  TEST_ASSERT_EQUAL(1, native::usb().sent.size());
+  TEST_ASSERT_EQUAL_UINT8(TRANSLATION_ID, native::usb().sent[0][0]);
+  native::usb().clear();
+
+  mouse.set_button(HIDSpaceMouse::FIT, true);
+  fake_host::run_slots(mouse, 5);
+  TEST_ASSERT_EQUAL(1, native::usb().sent.size());
+  TEST_ASSERT_EQUAL_UINT8(BUTTON_REPORT_ID, native::usb().sent[0][0]);
+}
+
+void test_sub_count_change_is_not_sent()
+{
+  fake_host::SpaceMouse mouse;
+
+  mouse.set_translation(10000, -10000, 10000);
+  fake_host::run_slots(mouse, 5);
+  native::usb().clear();
+
+  // a quarter of a HID count quantizes to the same counts
+  const q15_t step = Q15_MAX / POSITION_RANGE[1] / 4;
+  TEST_ASSERT_GREATER_THAN(0, step);
+  mouse.set_translation(10000 + step, -10000 - step, 10000 + step);
+  fake_host::run_slots(mouse, 5);
+  TEST_ASSERT_EQUAL(0, native::usb().sent.size());
+}
+
+void test_report_carries_latest_values()
+{
+  fake_host::SpaceMouse mouse;
+  mouse.set_translation(10000, 0, 0);
+  fake_host::run_slots(mouse, 1);
+  native::usb().clear();
+
+  // several changes before the next slot opens. only the last one is sent
+  mouse.set_translation(Q15_MAX, 0, 0);
+  mouse.update();
+  mouse.set_translation(0, Q15_MIN, 0);
+  mouse.update();
+  mouse.set_translation(0, 0, Q15_MAX);
+  fake_host::run_slots(mouse, 3);
+
+  std::vector<uint8_t> translation;
+  fake_host::append_axis(translation, 0);
+  fake_host::append_axis(translation, 0);
+  fake_host::append_axis(translation, POSITION_RANGE[1]);
+  TEST_ASSERT_EQUAL(1, native::usb().sent.size());
+  TEST_ASSERT_EQUAL_UINT8(TRANSLATION_ID, native::usb().sent[0][0]);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(translation.data(), &native::usb().sent[0][1], translation.size());
+}
+
+void test_value_changed_back_is_not_sent()
+{
+  fake_host::SpaceMouse mouse;
+  mouse.set_rotation(10000, 10000, 10000);
+  fake_host::run_slots(mouse, 1);
+  native::usb().clear();
+
+  mouse.set_rotation(20000, 10000, 10000);
+  mouse.set_rotation(10000, 10000, 10000);
+  fake_host::run_slots(mouse, 3);
+  TEST_ASSERT_EQUAL(0, native::usb().sent.size());
+}
+
+void test_data_age_is_measured_when_sent()
+{
+  fake_host::SpaceMouse mouse;
+  mouse.reset_data_age();
+
+  // the slot is free, so the report is sent by the next update()
+  mouse.set_translation(10000, 0, 0);
+  native::advance_millis(3);
+  mouse.update();
+  TEST_ASSERT_EQUAL(1, native::usb().sent.size());
+
+  // 3 ms falls in bucket [2, 4)
+  TEST_ASSERT_EQUAL_UINT16(1, mouse.get_data_age().buckets[2]);
+  TEST_ASSERT_EQUAL_UINT16(3, mouse.get_data_age().percentile(99));
+}
+
+void test_age_histogram_percentile()
+{
+  age_histogram_t histogram;
+  memset(&histogram, 0, sizeof(histogram));
+  TEST_ASSERT_EQUAL_UINT16(0, histogram.percentile(50));
+
+  // 90 samples of 0 ms, 9 of 5 ms, 1 of 100 ms
+  for (uint8_t i = 0; i < 90; i++)
+  {
+    histogram.add(0);
+  }
+  for (uint8_t i = 0; i < 9; i++)
+  {
+    histogram.add(5);
+  }
+  histogram.add(100);
+
+  TEST_ASSERT_EQUAL_UINT16(0, histogram.percentile(50));
+  TEST_ASSERT_EQUAL_UINT16(0, histogram.percentile(90));
+  TEST_ASSERT_EQUAL_UINT16(7, histogram.percentile(99));
+  TEST_ASSERT_EQUAL_UINT16(127, histogram.percentile(100));
+
+  // ages beyond the last bucket are counted in it
+  histogram.add(100000);
+  TEST_ASSERT_EQUAL_UINT16(1, histogram.buckets[AGE_HISTOGRAM_BUCKETS - 1]);
+}
+
+void test_button_is_sent_before_pending_motion()
+{
+  fake_host::SpaceMouse mouse;
+  mouse.set_translation(10000, 0, 0);
+  mouse.set_rotation(10000, 0, 0);
+  mouse.set_button(HIDSpaceMouse::ROTATE, true);
+  fake_host::run_slots(mouse, 4);
+
+  // the button takes the first slot, motion follows
+#if HID_SPACE_MOUSE_COMBINED_REPORT
+  const std::vector<uint8_t> expected = {BUTTON_REPORT_ID, MOTION_REPORT_ID};
+#else
+  const std::vector<uint8_t> expected = {BUTTON_REPORT_ID, TRANSLATION_REPORT_ID, ROTATION_REPORT_ID};
+#endif
+  TEST_ASSERT_EQUAL(expected.size(), native::usb().sent.size());
+  for (size_t i = 0; i < expected.size(); i++)
+  {
+    TEST_ASSERT_EQUAL_UINT8(expected[i], native::usb().sent[i][0]);
+  }
+}
+
+void test_button_latency_under_continuous_motion()
+{
+  fake_host::SpaceMouse mouse;
+
+  // motion changes every millisecond, a button toggles every 151 ms. update() runs every millisecond
+  uint32_t motion_reports = 0;
+  uint32_t button_reports = 0;
+  uint32_t toggle_millis = 0;
+  uint32_t max_latency = 0;
+  for (uint32_t ms = 0; ms < 5000; ms++)
+  {
+    const q15_t value = static_cast<q15_t>(static_cast<int32_t>((ms * 50) % 60000) - 30000);
+    mouse.set_translation(value, value, value);
+    mouse.set_rotation(value, value, value);
+    if (ms % 151 == 0)
+    {
+      mouse.set_button(HIDSpaceMouse::SHIFT, (ms / 151) % 2 == 0);
+      toggle_millis = millis();
+    }
+
+    native::usb().clear();
+    native::advance_millis(1);
+    mouse.update();
+    if (native::usb().sent.empty())
+    {
+      continue;
+    }
+
+    if (native::usb().sent[0][0] == BUTTON_REPORT_ID)
+    {
+      button_reports++;
+      max_latency = max_latency > millis() - toggle_millis ? max_latency : millis() - toggle_millis;
+    }
+    else
+    {
+      motion_reports++;
+    }
+  }
+
+  // every toggle was sent, within one report slot
+  TEST_ASSERT_EQUAL_UINT32(5000 / 151 + 1, button_reports);
+  TEST_ASSERT_LESS_OR_EQUAL(HID_REPORT_RATE, max_latency);
+  TEST_ASSERT_LESS_OR_EQUAL(2 * HID_REPORT_RATE - 1, mouse.get_button_latency().percentile(100));
+
+  // and motion was not starved
+  TEST_ASSERT_EQUAL_UINT32(5000 / HID_REPORT_RATE - button_reports, motion_reports);
+}
+
+void test_noise_at_rest_is_not_sent()
+{
+  fake_host::SpaceMouse mouse;
+
+  // an untouched puck dithering within the noise gate
+  for (uint16_t i = 0; i < 200; i++)
+  {
+    const int16_t noise = (i % 3) == 0 ? QUANTIZER_NOISE_GATE : (i % 3) == 1 ? -QUANTIZER_NOISE_GATE : 0;
+    mouse.set_translation(q15_counts(noise, POSITION_RANGE[1]), 0, q15_counts(-noise, POSITION_RANGE[1]));
+    mouse.set_rotation(0, q15_counts(noise, ROTATION_RANGE[1]), 0);
+    fake_host::run_slots(mouse, 1);
+  }
+  TEST_ASSERT_EQUAL(0, native::usb().sent.size());
+}
+
+void test_stopping_sends_a_single_zero_report()
+{
+  fake_host::SpaceMouse mouse;
+  mouse.set_translation(10000, -10000, 10000);
+  fake_host::run_slots(mouse, 2);
+  native::usb().clear();
+
+  // released, the puck settles within the noise gate
+  for (uint16_t i = 0; i < 50; i++)
+  {
+    const int16_t noise = (i % 2) == 0 ? QUANTIZER_NOISE_GATE : 0;
+    mouse.set_translation(q15_counts(noise, POSITION_RANGE[1]), 0, 0);
+    fake_host::run_slots(mouse, 1);
+  }
+
+  TEST_ASSERT_EQUAL(1, native::usb().sent.size());
+  TEST_ASSERT_EQUAL_UINT8(TRANSLATION_ID, native::usb().sent[0][0]);
+  for (size_t i = 1; i < native::usb().sent[0].size(); i++)
+  {
+    TEST_ASSERT_EQUAL_HEX8(0, native::usb().sent[0][i]);
+  }
+}
+
+void test_changes_within_hysteresis_are_not_sent()
+{
+  fake_host::SpaceMouse mouse;
+  const int16_t sent = 200;
+  mouse.set_translation(q15_counts(sent, POSITION_RANGE[1]), 0, 0);
+  fake_host::run_slots(mouse, 2);
+  native::usb().clear();
+
+  // dithering around the sent value
+  for (int16_t delta = -QUANTIZER_HYSTERESIS; delta <= QUANTIZER_HYSTERESIS; delta++)
+  {
+    mouse.set_translation(q15_counts(sent + delta, POSITION_RANGE[1]), 0, 0);
+    fake_host::run_slots(mouse, 1);
+  }
+  TEST_ASSERT_EQUAL(0, native::usb().sent.size());
+
+  // one count more is sent
+  mouse.set_translation(q15_counts(sent + QUANTIZER_HYSTERESIS + 1, POSITION_RANGE[1]), 0, 0);
+  fake_host::run_slots(mouse, 1);
+  TEST_ASSERT_EQUAL(1, native::usb().sent.size());
+  TEST_ASSERT_EQUAL_INT16(sent + QUANTIZER_HYSTERESIS + 1, static_cast<int16_t>(native::usb().sent[0][1] | (native::usb().sent[0][2] << 8)));
+}
+
+void test_set_idle_repeats_unchanged_reports()
+{
+  fake_host::SpaceMouse mouse;
+
+  // 25 * 4 ms = 100 ms for all reports
+  TEST_ASSERT_TRUE(fake_host::control_out(mouse, HID_SET_IDLE, 25, 0));
+  mouse.set_translation(10000, 0, 0);
+  mouse.reset_data_age();
+
+  // 1 s of updates every millisecond, without any change after the first
+  for (uint16_t ms = 0; ms < 1000; ms++)
+  {
+    native::advance_millis(1);
+    mouse.update();
+  }
+
+  // every input report is repeated every 100 ms
+  uint16_t counts[INPUT_REPORT_COUNT + 1] = {0};
+  for (const std::vector<uint8_t> &report : native::usb().sent)
+  {
+    counts[report[0]]++;
+  }
+  TEST_ASSERT_GREATER_OR_EQUAL(10, counts[TRANSLATION_ID]);
+  TEST_ASSERT_LESS_OR_EQUAL(11, counts[TRANSLATION_ID]);
+  TEST_ASSERT_GREATER_OR_EQUAL(9, counts[BUTTON_REPORT_ID]);
+  TEST_ASSERT_LESS_OR_EQUAL(10, counts[BUTTON_REPORT_ID]);
+
+  // only the one real change counts towards the data age
+  uint32_t samples = 0;
+  for (uint8_t i = 0; i < AGE_HISTOGRAM_BUCKETS; i++)
+  {
+    samples += mouse.get_data_age().buckets[i];
+  }
+  TEST_ASSERT_EQUAL_UINT32(1, samples);
+
+  // rate 0 stops the repeats
+  TEST_ASSERT_TRUE(fake_host::control_out(mouse, HID_SET_IDLE, 0, 0));
+  native::usb().clear();
+  fake_host::run_slots(mouse, 50);
+  TEST_ASSERT_EQUAL(0, native::usb().sent.size());
+}
+
+void test_get_idle_returns_rate_per_report()
+{
+  fake_host::SpaceMouse mouse;
+
+  // nothing is repeated by default
+  std::vector<uint8_t> rate = fake_host::control_in(mouse, HID_GET_IDLE, 0, 0);
+  TEST_ASSERT_EQUAL(1, rate.size());
+  TEST_ASSERT_EQUAL_UINT8(0, rate[0]);
+
+  TEST_ASSERT_TRUE(fake_host::control_out(mouse, HID_SET_IDLE, 25, 0));
+  TEST_ASSERT_TRUE(fake_host::control_out(mouse, HID_SET_IDLE, 10, BUTTON_REPORT_ID));
+
+  TEST_ASSERT_EQUAL_UINT8(25, fake_host::control_in(mouse, HID_GET_IDLE, 0, TRANSLATION_ID)[0]);
+  TEST_ASSERT_EQUAL_UINT8(10, fake_host::control_in(mouse, HID_GET_IDLE, 0, BUTTON_REPORT_ID)[0]);
+}
+
+void test_noise_gate_covers_the_same_deflection_at_every_resolution()
+{
+  fake_host::SpaceMouse mouse;
+
+  // one count at the reference range is rest, whatever the resolution
+  const q15_t reference_count = q15_counts(1, QUANTIZER_REFERENCE_RANGE);
+  mouse.set_translation(reference_count, -reference_count, reference_count);
+  mouse.set_rotation(-reference_count, reference_count, -reference_count);
+  fake_host::run_slots(mouse, 5);
+  TEST_ASSERT_EQUAL(0, native::usb().sent.size());
+
+  // two counts are not
+  mouse.set_translation(2 * reference_count, 0, 0);
+  fake_host::run_slots(mouse, 5);
+  TEST_ASSERT_EQUAL(1, native::usb().sent.size());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_nothing_is_sent_without_changes);
+  RUN_TEST(test_only_changed_reports_are_sent);
+  RUN_TEST(test_sub_count_change_is_not_sent);
+  RUN_TEST(test_report_carries_latest_values);
+  RUN_TEST(test_value_changed_back_is_not_sent);
+  RUN_TEST(test_data_age_is_measured_when_sent);
+  RUN_TEST(test_age_histogram_percentile);
+  RUN_TEST(test_button_is_sent_before_pending_motion);
+  RUN_TEST(test_button_latency_under_continuous_motion);
+  RUN_TEST(test_noise_at_rest_is_not_sent);
+  RUN_TEST(test_stopping_sends_a_single_zero_report);
+  RUN_TEST(test_changes_within_hysteresis_are_not_sent);
+  RUN_TEST(test_set_idle_repeats_unchanged_reports);
+  RUN_TEST(test_get_idle_returns_rate_per_report);
+  RUN_TEST(test_noise_gate_covers_the_same_deflection_at_every_resolution);
+  return UNITY_END();
+}
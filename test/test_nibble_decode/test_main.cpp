@@ -0,0 +1,153 @@
+#include <unity.h>
+#include "magellan/MagellanParser.hpp"
+
+using namespace magellan_internal;
+
+/**
+ * reference nibble decoder, as it was before the lookup table was introduced
+ * @return the nibble value, or -1 for characters that are not nibbles
+ */
+static int reference_decode_nibble(const char c)
+{
+  switch (c)
+  {
+    case '0': return 0;
+    case 'A': return 1;
+    case 'B': return 2;
+    case '3': return 3;
+    case 'D': return 4;
+    case '5': return 5;
+    case '6': return 6;
+    case 'G': return 7;
+    case 'H': return 8;
+    case '9': return 9;
+    case ':': return 10;
+    case 'K': return 11;
+    case '<': return 12;
+    case 'M': return 13;
+    case 'N': return 14;
+    case '?': return 15;
+    default: return -1;
+  }
+}
+
+/**
+ * reference word decoder, as it was before the lookup table was introduced
+ */
+static int16_t reference_decode_signed_word(const char *buffer)
+{
+  const uint8_t n0 = reference_decode_nibble(buffer[0]);
+  const uint8_t n1 = reference_decode_nibble(buffer[1]);
+  const uint8_t n2 = reference_decode_nibble(buffer[2]);
+  const uint8_t n3 = reference_decode_nibble(buffer[3]);
+
+  int16_t value = static_cast<int16_t>(n1 << 8 | n2 << 4 | n3);
+  if ((n0 & 0x08) == 0)
+  {
+    value = -(4096 - value);
+  }
+
+  return value;
+}
+
+typedef axis_pipeline_t<
+    axis_map_t<AXIS_X, -4096, 4095>,
+    axis_map_t<AXIS_Y, -4096, 4095>,
+    axis_map_t<AXIS_Z, -4096, 4095>,
+    axis_map_t<AXIS_U, -4096, 4095>,
+    axis_map_t<AXIS_V, -4096, 4095>,
+    axis_map_t<AXIS_W, -4096, 4095>>
+    pipeline;
+
+static void encode_word(const uint16_t word, char *buffer)
+{
+  buffer[0] = NIBBLE_CHARS[(word >> 12) & 0x0F];
+  buffer[1] = NIBBLE_CHARS[(word >> 8) & 0x0F];
+  buffer[2] = NIBBLE_CHARS[(word >> 4) & 0x0F];
+  buffer[3] = NIBBLE_CHARS[word & 0x0F];
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+void test_table_matches_reference_for_every_byte()
+{
+  for (uint16_t c = 0; c < 256; c++)
+  {
+    const uint8_t entry = pgm_read_byte(&NIBBLE_TABLE[c]);
+    const int expected = reference_decode_nibble(static_cast<char>(c));
+
+    char message[32];
+    snprintf(message, sizeof(message), "character 0x%02X", c);
+    if (expected < 0)
+    {
+      TEST_ASSERT_EQUAL_HEX8_MESSAGE(0, entry, message);
+    }
+    else
+    {
+      TEST_ASSERT_EQUAL_HEX8_MESSAGE(expected | NIBBLE_VALID, entry, message);
+    }
+
+    TEST_ASSERT_EQUAL_HEX8_MESSAGE(nibble_table_entry(c), entry, message);
+  }
+}
+
+void test_nibble_chars_round_trip()
+{
+  TEST_ASSERT_EQUAL(17, sizeof(NIBBLE_CHARS));
+  for (uint8_t n = 0; n < 16; n++)
+  {
+    TEST_ASSERT_EQUAL(n, reference_decode_nibble(NIBBLE_CHARS[n]));
+    TEST_ASSERT_EQUAL_HEX8(n | NIBBLE_VALID, pgm_read_byte(&NIBBLE_TABLE[static_cast<uint8_t>(NIBBLE_CHARS[n])]));
+  }
+}
+
+void test_parser_decodes_every_word_like_reference()
+{
+  MagellanSerial serial;
+  MagellanParser parser(&pipeline::apply);
+  parser.begin(&serial);
+
+  // every 16 bit word, six per position message
+  for (uint32_t first = 0; first < 0x10000; first += 6)
+  {
+    char frame[1 + 24 + 1];
+    frame[0] = 'd';
+    for (uint8_t i = 0; i < 6; i++)
+    {
+      encode_word(static_cast<uint16_t>((first + i) & 0xFFFF), &frame[1 + i * 4]);
+    }
+    frame[25] = '\r';
+
+    for (uint8_t i = 0; i < sizeof(frame); i++)
+    {
+      serial.receive(frame[i], false, false);
+    }
+    parser.update();
+
+    // word order on the wire is x, z, y, u, w, v
+    TEST_ASSERT_EQUAL_INT16(reference_decode_signed_word(&frame[1]), parser.get_x_raw());
+    TEST_ASSERT_EQUAL_INT16(reference_decode_signed_word(&frame[5]), parser.get_z_raw());
+    TEST_ASSERT_EQUAL_INT16(reference_decode_signed_word(&frame[9]), parser.get_y_raw());
+    TEST_ASSERT_EQUAL_INT16(reference_decode_signed_word(&frame[13]), parser.get_u_raw());
+    TEST_ASSERT_EQUAL_INT16(reference_decode_signed_word(&frame[17]), parser.get_w_raw());
+    TEST_ASSERT_EQUAL_INT16(reference_decode_signed_word(&frame[21]), parser.get_v_raw());
+  }
+
+  TEST_ASSERT_EQUAL(0, parser.get_link_stats().frames_lost);
+  TEST_ASSERT_EQUAL(0, parser.get_link_stats().decode_errors);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_table_matches_reference_for_every_byte);
+  RUN_TEST(test_nibble_chars_round_trip);
+  RUN_TEST(test_parser_decodes_every_word_like_reference);
+  return UNITY_END();
+}
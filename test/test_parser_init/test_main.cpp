@@ -0,0 +1,258 @@
+#include <unity.h>
+#include "FakeMagellan.hpp"
+
+using namespace magellan_internal;
+using namespace fake_magellan;
+
+// null radius 2 is sent as its nibble character
+static const char *const CONFIG_COMMANDS[] = {"kQ", "m3", "qGG", "nB", "z"};
+
+/**
+ * run the parser and the simulated space mouse
+ * @return true once the parser is ready, false if it was not ready within timeout
+ */
+static bool run_until_ready(MagellanParser &parser, FakePuck &puck, const uint32_t timeout)
+{
+  for (uint32_t i = 0; i < timeout; i++)
+  {
+    native::advance_millis(1);
+    puck.tick();
+    parser.update();
+    if (parser.ready())
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void assert_nothing_lost(const FakePuck &puck)
+{
+  for (const FakePuck::command_t &command : puck.commands)
+  {
+    TEST_ASSERT_FALSE_MESSAGE(command.lost, command.text.c_str());
+  }
+}
+
+/**
+ * run the parser and the simulated space mouse
+ * @return false if the parser was not ready at any point
+ */
+static bool run_while_ready(MagellanParser &parser, FakePuck &puck, const uint32_t duration)
+{
+  bool always_ready = true;
+  for (uint32_t i = 0; i < duration; i++)
+  {
+    native::advance_millis(1);
+    puck.tick();
+    parser.update();
+    always_ready = always_ready && parser.ready();
+  }
+  return always_ready;
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+void test_config_is_sent_after_reset_completes()
+{
+  MagellanSerial serial;
+  FakePuck puck(serial);
+  MagellanParser parser(&identity_pipeline::apply);
+  parser.begin(&serial);
+
+  TEST_ASSERT_TRUE(run_until_ready(parser, puck, 3000));
+
+  // the detection probe is answered before the reset is sent
+  const FakePuck::command_t *reset = puck.find("vt");
+  TEST_ASSERT_NOT_NULL(reset);
+  TEST_ASSERT_EQUAL(1, puck.count("vt"));
+
+  // nothing is sent while the space mouse resets, so every config command is answered the first time
+  for (const char *command : CONFIG_COMMANDS)
+  {
+    const FakePuck::command_t *config = puck.find(command);
+    TEST_ASSERT_NOT_NULL(config);
+    TEST_ASSERT_EQUAL_MESSAGE(1, puck.count(command), command);
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(reset->millis + puck.reset_duration, config->millis);
+  }
+  assert_nothing_lost(puck);
+
+  // the reset step took as long as the space mouse was busy
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32(puck.reset_duration, parser.get_init_timing().step[INIT_STEP_RESET]);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(puck.reset_duration + 100, parser.get_init_timing().step[INIT_STEP_RESET]);
+}
+
+void test_late_power_on_is_detected()
+{
+  MagellanSerial serial;
+  FakePuck puck(serial);
+  MagellanParser parser(&identity_pipeline::apply);
+  puck.power_off();
+  parser.begin(&serial);
+
+  TEST_ASSERT_FALSE(run_until_ready(parser, puck, 1000));
+
+  puck.powered = true;
+  const size_t commands_before_power_on = puck.commands.size();
+  TEST_ASSERT_EQUAL(0, commands_before_power_on);
+  TEST_ASSERT_TRUE(run_until_ready(parser, puck, 3000));
+
+  TEST_ASSERT_EQUAL(1, puck.count("vt"));
+  for (const char *command : CONFIG_COMMANDS)
+  {
+    TEST_ASSERT_EQUAL_MESSAGE(1, puck.count(command), command);
+  }
+  assert_nothing_lost(puck);
+}
+
+void test_slow_probe_answer_is_not_taken_for_reset()
+{
+  MagellanSerial serial;
+  FakePuck puck(serial);
+  MagellanParser parser(&identity_pipeline::apply);
+  puck.answer_delay = 30;
+  parser.begin(&serial);
+
+  TEST_ASSERT_TRUE(run_until_ready(parser, puck, 3000));
+
+  const FakePuck::command_t *reset = puck.find("vt");
+  TEST_ASSERT_NOT_NULL(reset);
+  for (const char *command : CONFIG_COMMANDS)
+  {
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(reset->millis + puck.reset_duration, puck.find(command)->millis);
+  }
+  assert_nothing_lost(puck);
+}
+
+void test_mode_mismatch_resends_only_mode()
+{
+  MagellanSerial serial;
+  FakePuck puck(serial);
+  MagellanParser parser(&identity_pipeline::apply);
+  parser.begin(&serial);
+  TEST_ASSERT_TRUE(run_until_ready(parser, puck, 3000));
+
+  // the space mouse reports another mode on the next link probe, e.g. while a mode switch is in flight
+  puck.mode = NIBBLE_CHARS[MODE_TRANSLATION];
+  TEST_ASSERT_TRUE(run_while_ready(parser, puck, LINK_QUIET_TIMEOUT + 200));
+
+  TEST_ASSERT_GREATER_OR_EQUAL(1, puck.count("mQ"));
+  TEST_ASSERT_EQUAL(2, puck.count("m3"));
+  TEST_ASSERT_EQUAL('3', puck.mode);
+  TEST_ASSERT_EQUAL(MODE_TRANSLATION_ROTATION, parser.get_mode());
+
+  // nothing else is configured again
+  TEST_ASSERT_EQUAL(1, puck.count("vt"));
+  TEST_ASSERT_EQUAL(1, puck.count("kQ"));
+  TEST_ASSERT_EQUAL(1, puck.count("qGG"));
+  TEST_ASSERT_EQUAL(1, puck.count("nB"));
+  TEST_ASSERT_EQUAL(1, puck.count("z"));
+}
+
+void test_power_cycle_reconfigures()
+{
+  MagellanSerial serial;
+  FakePuck puck(serial);
+  MagellanParser parser(&identity_pipeline::apply);
+  parser.begin(&serial);
+  TEST_ASSERT_TRUE(run_until_ready(parser, puck, 3000));
+
+  // the link goes down when the probes are not answered
+  puck.power_off();
+  TEST_ASSERT_FALSE(run_while_ready(parser, puck, LINK_QUIET_TIMEOUT + LINK_PROBE_TIMEOUT + 100));
+  TEST_ASSERT_FALSE(parser.ready());
+
+  // and the whole config is sent again once the space mouse answers
+  puck.powered = true;
+  TEST_ASSERT_TRUE(run_until_ready(parser, puck, 3000));
+  for (const char *command : CONFIG_COMMANDS)
+  {
+    TEST_ASSERT_EQUAL_MESSAGE(2, puck.count(command), command);
+  }
+}
+
+void test_null_radius_ack_is_optional()
+{
+  MagellanSerial serial;
+  FakePuck puck(serial);
+  MagellanParser parser(&identity_pipeline::apply);
+  puck.silent_commands = "kn";
+  parser.begin(&serial);
+
+  TEST_ASSERT_TRUE(run_until_ready(parser, puck, 3000));
+
+  // completed on the first timeout, without sending the config again
+  for (const char *command : CONFIG_COMMANDS)
+  {
+    TEST_ASSERT_EQUAL_MESSAGE(1, puck.count(command), command);
+  }
+  TEST_ASSERT_EQUAL_UINT32(INIT_ACK_TIMEOUT, parser.get_init_timing().step[INIT_STEP_BUTTONS]);
+  TEST_ASSERT_EQUAL_UINT32(INIT_ACK_TIMEOUT, parser.get_init_timing().step[INIT_STEP_NULL_RADIUS]);
+  TEST_ASSERT_LESS_THAN_UINT32(INIT_ACK_TIMEOUT, parser.get_init_timing().step[INIT_STEP_SENSITIVITY]);
+}
+
+void test_required_ack_is_retried()
+{
+  MagellanSerial serial;
+  FakePuck puck(serial);
+  MagellanParser parser(&identity_pipeline::apply);
+  puck.silent_commands = "q";
+  parser.begin(&serial);
+
+  TEST_ASSERT_FALSE(run_until_ready(parser, puck, 2000));
+  TEST_ASSERT_GREATER_OR_EQUAL(2, puck.count("qGG"));
+}
+
+void test_ready_transitions_are_reported_once()
+{
+  MagellanSerial serial;
+  FakePuck puck(serial);
+  MagellanParser parser(&identity_pipeline::apply);
+  parser.begin(&serial);
+
+  // becoming ready is reported by exactly the update() that made the parser ready
+  uint16_t ready_changes = 0;
+  for (uint32_t i = 0; i < 3000; i++)
+  {
+    native::advance_millis(1);
+    puck.tick();
+    const bool was_ready = parser.ready();
+    const uint8_t changed = parser.update();
+    TEST_ASSERT_EQUAL((changed & CHANGED_READY) != 0, parser.ready() != was_ready);
+    ready_changes += (changed & CHANGED_READY) != 0 ? 1 : 0;
+  }
+  TEST_ASSERT_TRUE(parser.ready());
+  TEST_ASSERT_EQUAL(1, ready_changes);
+
+  // and so is losing the link
+  puck.power_off();
+  ready_changes = 0;
+  for (uint32_t i = 0; i < LINK_QUIET_TIMEOUT + LINK_PROBE_TIMEOUT + 100; i++)
+  {
+    native::advance_millis(1);
+    puck.tick();
+    ready_changes += (parser.update() & CHANGED_READY) != 0 ? 1 : 0;
+  }
+  TEST_ASSERT_FALSE(parser.ready());
+  TEST_ASSERT_EQUAL(1, ready_changes);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_config_is_sent_after_reset_completes);
+  RUN_TEST(test_late_power_on_is_detected);
+  RUN_TEST(test_slow_probe_answer_is_not_taken_for_reset);
+  RUN_TEST(test_mode_mismatch_resends_only_mode);
+  RUN_TEST(test_power_cycle_reconfigures);
+  RUN_TEST(test_null_radius_ack_is_optional);
+  RUN_TEST(test_required_ack_is_retried);
+  RUN_TEST(test_ready_transitions_are_reported_once);
+  return UNITY_END();
+}
@@ -0,0 +1,271 @@
+/**
+ * reporting modes 1 and 2, and the adaptive reporting mode switching between them.
+ * needs ADAPTIVE_REPORTING_MODE, run with `pio test -e native_adaptive`
+ *
+ * @note
+ * the 12 character layout of modes 1 and 2 is not documented. FakePuck sends the layout the parser assumes,
+ * so these tests cover the decoding and the switching policy, not the layout itself
+ */
+#include <unity.h>
+#include "FakeMagellan.hpp"
+
+using namespace magellan_internal;
+using namespace fake_magellan;
+
+/**
+ * time between two position messages. long enough for a 24 character message at one character per millisecond
+ */
+static const uint32_t FRAME_INTERVAL = 30; // ms
+
+/**
+ * run the parser and the simulated space mouse
+ */
+static void run(MagellanParser &parser, FakePuck &puck, const uint32_t duration)
+{
+  for (uint32_t i = 0; i < duration; i++)
+  {
+    native::advance_millis(1);
+    puck.tick();
+    parser.update();
+  }
+}
+
+static void run_until_ready(MagellanParser &parser, FakePuck &puck)
+{
+  for (uint32_t i = 0; i < 3000 && !parser.ready(); i++)
+  {
+    run(parser, puck, 1);
+  }
+  TEST_ASSERT_TRUE(parser.ready());
+}
+
+/**
+ * send position messages in the current mode of the space mouse, one per FRAME_INTERVAL
+ */
+static void send_frames(MagellanParser &parser, FakePuck &puck, const uint8_t count, const int16_t x, const int16_t y, const int16_t z, const int16_t u, const int16_t v, const int16_t w)
+{
+  for (uint8_t i = 0; i < count; i++)
+  {
+    puck.send_position(x, y, z, u, v, w);
+    run(parser, puck, FRAME_INTERVAL);
+  }
+}
+
+/**
+ * move the puck with translation only, until the parser switched to MODE_TRANSLATION and the space mouse answered
+ * @return the command that switched the mode. a copy, commands is appended to later
+ */
+static FakePuck::command_t enter_translation_mode(MagellanParser &parser, FakePuck &puck)
+{
+  send_frames(parser, puck, ADAPTIVE_ENTER_MESSAGES, 500, 0, 0, 0, 0, 0);
+  run(parser, puck, FRAME_INTERVAL);
+
+  const FakePuck::command_t *command = puck.find_last("mA");
+  TEST_ASSERT_NOT_NULL(command);
+  TEST_ASSERT_EQUAL_UINT8(MODE_TRANSLATION, puck.get_mode());
+  TEST_ASSERT_EQUAL_UINT8(MODE_TRANSLATION, parser.get_mode());
+  return *command;
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+void test_translation_dominated_motion_switches_to_mode_1()
+{
+  MagellanSerial serial;
+  FakePuck puck(serial);
+  MagellanParser parser(&identity_pipeline::apply);
+  parser.begin(&serial);
+  run_until_ready(parser, puck);
+
+  // one message short of the streak, nothing happens
+  send_frames(parser, puck, ADAPTIVE_ENTER_MESSAGES - 1, 500, 0, 0, 0, 0, 0);
+  TEST_ASSERT_NULL(puck.find("mA"));
+
+  send_frames(parser, puck, 1, 500, 0, 0, 0, 0, 0);
+  run(parser, puck, FRAME_INTERVAL);
+  TEST_ASSERT_EQUAL(1, puck.count("mA"));
+  TEST_ASSERT_EQUAL_UINT8(MODE_TRANSLATION, parser.get_mode());
+
+  // 12 character messages with the translation words, rotation reads 0
+  send_frames(parser, puck, 1, 400, -350, 300, 0, 0, 0);
+  TEST_ASSERT_EQUAL_INT16(400, parser.get_x_raw());
+  TEST_ASSERT_EQUAL_INT16(-350, parser.get_y_raw());
+  TEST_ASSERT_EQUAL_INT16(300, parser.get_z_raw());
+  TEST_ASSERT_EQUAL_INT16(0, parser.get_u_raw());
+  TEST_ASSERT_EQUAL_INT16(0, parser.get_v_raw());
+  TEST_ASSERT_EQUAL_INT16(0, parser.get_w_raw());
+  TEST_ASSERT_TRUE(parser.ready());
+}
+
+void test_rotation_dominated_motion_switches_to_mode_2()
+{
+  MagellanSerial serial;
+  FakePuck puck(serial);
+  MagellanParser parser(&identity_pipeline::apply);
+  parser.begin(&serial);
+  run_until_ready(parser, puck);
+
+  send_frames(parser, puck, ADAPTIVE_ENTER_MESSAGES, 0, 0, 0, 0, -500, 0);
+  run(parser, puck, FRAME_INTERVAL);
+  TEST_ASSERT_EQUAL(1, puck.count("mB"));
+  TEST_ASSERT_EQUAL_UINT8(MODE_ROTATION, parser.get_mode());
+
+  // 12 character messages with the rotation words, translation reads 0
+  send_frames(parser, puck, 1, 0, 0, 0, 250, -450, 120);
+  TEST_ASSERT_EQUAL_INT16(0, parser.get_x_raw());
+  TEST_ASSERT_EQUAL_INT16(0, parser.get_y_raw());
+  TEST_ASSERT_EQUAL_INT16(0, parser.get_z_raw());
+  TEST_ASSERT_EQUAL_INT16(250, parser.get_u_raw());
+  TEST_ASSERT_EQUAL_INT16(-450, parser.get_v_raw());
+  TEST_ASSERT_EQUAL_INT16(120, parser.get_w_raw());
+}
+
+void test_payload_length_follows_the_mode()
+{
+  MagellanSerial serial;
+  FakePuck puck(serial);
+  MagellanParser parser(&identity_pipeline::apply);
+  parser.begin(&serial);
+  run_until_ready(parser, puck);
+
+  // a 12 character message in mode 3 is dropped
+  send_frames(parser, puck, 1, 7, 7, 7, 7, 7, 7);
+  puck.send(position_message(MODE_TRANSLATION, 100, 100, 100, 0, 0, 0));
+  run(parser, puck, FRAME_INTERVAL);
+  TEST_ASSERT_EQUAL_INT16(7, parser.get_x_raw());
+  TEST_ASSERT_EQUAL_INT16(7, parser.get_u_raw());
+
+  // in mode 1, the message is dispatched after 12 characters. a 24 character message only gives its translation words,
+  // the rest is skipped until the next message
+  enter_translation_mode(parser, puck);
+  puck.send(position_message(MODE_TRANSLATION_ROTATION, 100, 200, 300, 400, 400, 400));
+  run(parser, puck, FRAME_INTERVAL);
+  TEST_ASSERT_EQUAL_INT16(100, parser.get_x_raw());
+  TEST_ASSERT_EQUAL_INT16(200, parser.get_y_raw());
+  TEST_ASSERT_EQUAL_INT16(300, parser.get_z_raw());
+  TEST_ASSERT_EQUAL_INT16(0, parser.get_u_raw());
+
+  send_frames(parser, puck, 1, 400, 400, 400, 0, 0, 0);
+  TEST_ASSERT_EQUAL_INT16(400, parser.get_x_raw());
+  TEST_ASSERT_EQUAL_INT16(0, parser.get_u_raw());
+  TEST_ASSERT_EQUAL_UINT8(MODE_TRANSLATION, parser.get_mode());
+}
+
+void test_mixed_motion_does_not_switch()
+{
+  MagellanSerial serial;
+  FakePuck puck(serial);
+  MagellanParser parser(&identity_pipeline::apply);
+  parser.begin(&serial);
+  run_until_ready(parser, puck);
+
+  // translation is large, but not ADAPTIVE_DOMINANCE_RATIO times the rotation
+  send_frames(parser, puck, 3 * ADAPTIVE_ENTER_MESSAGES, 500, 0, 0, 200, 0, 0);
+
+  // dominated, but below ADAPTIVE_ENTER_MAGNITUDE
+  send_frames(parser, puck, 3 * ADAPTIVE_ENTER_MESSAGES, ADAPTIVE_ENTER_MAGNITUDE - 1, 0, 0, 0, 0, 0);
+
+  // a streak interrupted by a single mixed message starts over
+  send_frames(parser, puck, ADAPTIVE_ENTER_MESSAGES - 1, 500, 0, 0, 0, 0, 0);
+  send_frames(parser, puck, 1, 500, 0, 0, 200, 0, 0);
+  send_frames(parser, puck, ADAPTIVE_ENTER_MESSAGES - 1, 500, 0, 0, 0, 0, 0);
+  TEST_ASSERT_NULL(puck.find("mA"));
+
+  send_frames(parser, puck, 1, 500, 0, 0, 0, 0, 0);
+  run(parser, puck, FRAME_INTERVAL);
+  TEST_ASSERT_NOT_NULL(puck.find("mA"));
+}
+
+void test_exit_uses_lower_magnitude()
+{
+  MagellanSerial serial;
+  FakePuck puck(serial);
+  MagellanParser parser(&identity_pipeline::apply);
+  parser.begin(&serial);
+  run_until_ready(parser, puck);
+  const size_t init_count = puck.count("m3");
+  enter_translation_mode(parser, puck);
+
+  // between the exit and the enter magnitude, the mode is kept
+  send_frames(parser, puck, ADAPTIVE_MIN_SWITCH_INTERVAL / FRAME_INTERVAL + 2, ADAPTIVE_EXIT_MAGNITUDE + 50, 0, 0, 0, 0, 0);
+  TEST_ASSERT_EQUAL(init_count, puck.count("m3"));
+
+  send_frames(parser, puck, 1, ADAPTIVE_EXIT_MAGNITUDE - 1, 0, 0, 0, 0, 0);
+  run(parser, puck, FRAME_INTERVAL);
+  TEST_ASSERT_EQUAL(init_count + 1, puck.count("m3"));
+  TEST_ASSERT_EQUAL_UINT8(MODE_TRANSLATION_ROTATION, parser.get_mode());
+}
+
+void test_switches_are_rate_limited()
+{
+  MagellanSerial serial;
+  FakePuck puck(serial);
+  MagellanParser parser(&identity_pipeline::apply);
+  parser.begin(&serial);
+  run_until_ready(parser, puck);
+  const FakePuck::command_t enter = enter_translation_mode(parser, puck);
+
+  // the puck is at rest right away, but the mode is only switched back after ADAPTIVE_MIN_SWITCH_INTERVAL
+  send_frames(parser, puck, ADAPTIVE_MIN_SWITCH_INTERVAL / FRAME_INTERVAL + 2, 0, 0, 0, 0, 0, 0);
+  const FakePuck::command_t *exit = puck.find_last("m3");
+  TEST_ASSERT_NOT_NULL(exit);
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32(enter.millis + ADAPTIVE_MIN_SWITCH_INTERVAL, exit->millis);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(enter.millis + ADAPTIVE_MIN_SWITCH_INTERVAL + FRAME_INTERVAL, exit->millis);
+  const uint32_t exit_millis = exit->millis;
+
+  // dominated motion right after switching back is not counted until ADAPTIVE_MIN_SWITCH_INTERVAL passed,
+  // so the streak only starts after it
+  for (uint8_t i = 0; i < 50 && puck.count("mA") < 2; i++)
+  {
+    send_frames(parser, puck, 1, 500, 0, 0, 0, 0, 0);
+  }
+  const FakePuck::command_t *enter_again = puck.find_last("mA");
+  TEST_ASSERT_EQUAL(2, puck.count("mA"));
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32(exit_millis + ADAPTIVE_MIN_SWITCH_INTERVAL + (ADAPTIVE_ENTER_MESSAGES - 2) * FRAME_INTERVAL, enter_again->millis);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(exit_millis + ADAPTIVE_MIN_SWITCH_INTERVAL + (ADAPTIVE_ENTER_MESSAGES + 1) * FRAME_INTERVAL, enter_again->millis);
+}
+
+void test_single_group_is_left_after_max_dwell()
+{
+  MagellanSerial serial;
+  FakePuck puck(serial);
+  MagellanParser parser(&identity_pipeline::apply);
+  parser.begin(&serial);
+  run_until_ready(parser, puck);
+  const FakePuck::command_t enter = enter_translation_mode(parser, puck);
+
+  // continuous translation, both groups are checked again after ADAPTIVE_MAX_DWELL
+  send_frames(parser, puck, ADAPTIVE_MAX_DWELL / FRAME_INTERVAL + 2, 500, 0, 0, 0, 0, 0);
+  const FakePuck::command_t *exit = puck.find_last("m3");
+  TEST_ASSERT_NOT_NULL(exit);
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32(enter.millis + ADAPTIVE_MAX_DWELL, exit->millis);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(enter.millis + ADAPTIVE_MAX_DWELL + FRAME_INTERVAL, exit->millis);
+}
+
+void test_needs_adaptive_reporting_mode()
+{
+  TEST_IGNORE_MESSAGE("needs ADAPTIVE_REPORTING_MODE=1, run with `pio test -e native_adaptive`");
+}
+
+int main()
+{
+  UNITY_BEGIN();
+#if ADAPTIVE_REPORTING_MODE
+  RUN_TEST(test_translation_dominated_motion_switches_to_mode_1);
+  RUN_TEST(test_rotation_dominated_motion_switches_to_mode_2);
+  RUN_TEST(test_payload_length_follows_the_mode);
+  RUN_TEST(test_mixed_motion_does_not_switch);
+  RUN_TEST(test_exit_uses_lower_magnitude);
+  RUN_TEST(test_switches_are_rate_limited);
+  RUN_TEST(test_single_group_is_left_after_max_dwell);
+#else
+  RUN_TEST(test_needs_adaptive_reporting_mode);
+#endif
+  return UNITY_END();
+}
@@ -0,0 +1,258 @@
+#include <unity.h>
+#include "FakeMagellan.hpp"
+
+using namespace magellan_internal;
+using namespace fake_magellan;
+
+static MagellanSerial serial;
+static MagellanParser parser(&identity_pipeline::apply);
+
+void setUp()
+{
+  serial.begin(BAUD_RATE);
+  parser = MagellanParser(&identity_pipeline::apply);
+  parser.begin(&serial);
+}
+
+void tearDown()
+{
+}
+
+static void assert_position(const int16_t x, const int16_t y, const int16_t z, const int16_t u, const int16_t v, const int16_t w)
+{
+  TEST_ASSERT_EQUAL_INT16(x, parser.get_x_raw());
+  TEST_ASSERT_EQUAL_INT16(y, parser.get_y_raw());
+  TEST_ASSERT_EQUAL_INT16(z, parser.get_z_raw());
+  TEST_ASSERT_EQUAL_INT16(u, parser.get_u_raw());
+  TEST_ASSERT_EQUAL_INT16(v, parser.get_v_raw());
+  TEST_ASSERT_EQUAL_INT16(w, parser.get_w_raw());
+}
+
+void test_single_position_message_is_applied()
+{
+  receive(serial, position_message(1, -2, 3, -4, 5, -6));
+  TEST_ASSERT_EQUAL_HEX8(CHANGED_TRANSLATION | CHANGED_ROTATION, parser.update() & (CHANGED_TRANSLATION | CHANGED_ROTATION));
+
+  assert_position(1, -2, 3, -4, 5, -6);
+  TEST_ASSERT_EQUAL(0, parser.get_merged_frames());
+
+  // normalized once: 1 / 4095 in Q15
+  TEST_ASSERT_EQUAL_INT16(8, parser.get_x_q15());
+}
+
+void test_queued_position_messages_are_merged()
+{
+  receive(serial, position_message(1, 1, 1, 1, 1, 1));
+  receive(serial, position_message(2, 2, 2, 2, 2, 2));
+  parser.update();
+
+  assert_position(2, 2, 2, 2, 2, 2);
+  TEST_ASSERT_EQUAL(1, parser.get_merged_frames());
+}
+
+void test_corrupt_next_message_keeps_current_one()
+{
+  // the second message has an invalid payload character, so the first one must be applied
+  std::string corrupt = position_message(2, 2, 2, 2, 2, 2);
+  corrupt[10] = 'x';
+  receive(serial, position_message(100, -100, 200, -200, 300, -300));
+  receive(serial, corrupt);
+  parser.update();
+
+  assert_position(100, -100, 200, -200, 300, -300);
+  TEST_ASSERT_EQUAL(0, parser.get_merged_frames());
+  TEST_ASSERT_EQUAL(1, parser.get_link_stats().frames_lost);
+}
+
+void test_line_error_in_next_message_keeps_current_one()
+{
+  const std::string next = position_message(2, 2, 2, 2, 2, 2);
+  receive(serial, position_message(7, 7, 7, 7, 7, 7));
+  receive(serial, next.substr(0, 12));
+  serial.receive('0', true, false);
+  receive(serial, next.substr(13));
+  parser.update();
+
+  assert_position(7, 7, 7, 7, 7, 7);
+  TEST_ASSERT_EQUAL(0, parser.get_merged_frames());
+  TEST_ASSERT_EQUAL(1, parser.get_link_stats().framing_errors);
+  TEST_ASSERT_EQUAL(1, parser.get_link_stats().frames_lost);
+}
+
+void test_overrun_in_next_message_keeps_current_one()
+{
+  const uint16_t overruns = serial.get_overruns();
+  const std::string next = position_message(2, 2, 2, 2, 2, 2);
+  receive(serial, position_message(7, 7, 7, 7, 7, 7));
+  receive(serial, next.substr(0, 12));
+
+  // bytes were lost before this one, it is valid itself
+  serial.receive(next[12], false, true);
+  receive(serial, next.substr(13));
+  TEST_ASSERT_EQUAL(overruns + 1, serial.get_overruns());
+  parser.update();
+
+  assert_position(7, 7, 7, 7, 7, 7);
+  TEST_ASSERT_EQUAL(0, parser.get_merged_frames());
+  TEST_ASSERT_EQUAL(1, parser.get_link_stats().overruns);
+  TEST_ASSERT_EQUAL(0, parser.get_link_stats().framing_errors);
+  TEST_ASSERT_EQUAL(1, parser.get_link_stats().frames_lost);
+}
+
+void test_overrun_is_marked_before_the_byte()
+{
+  serial.receive('k', false, true);
+
+  TEST_ASSERT_EQUAL(2, serial.available());
+  TEST_ASSERT_EQUAL_HEX8(RX_MARKER_OVERRUN, serial.read());
+  TEST_ASSERT_EQUAL('k', serial.read());
+}
+
+void test_full_ring_buffer_is_an_overrun()
+{
+  const uint16_t overruns = serial.get_overruns();
+
+  // two messages of 26 bytes fit into the 64 byte ring buffer, the third one overflows it
+  receive(serial, position_message(1, 1, 1, 1, 1, 1));
+  receive(serial, position_message(2, 2, 2, 2, 2, 2));
+  receive(serial, position_message(3, 3, 3, 3, 3, 3));
+  TEST_ASSERT_EQUAL(MAGELLAN_SERIAL_RX_RING_SIZE - 1, serial.available());
+
+  // counted once, no matter how many bytes were dropped
+  TEST_ASSERT_EQUAL(overruns + 1, serial.get_overruns());
+
+  parser.update();
+  assert_position(2, 2, 2, 2, 2, 2);
+  TEST_ASSERT_EQUAL(0, serial.available());
+
+  // the marker is inserted as soon as there is space again, and ends the truncated message
+  receive(serial, position_message(4, 4, 4, 4, 4, 4));
+  TEST_ASSERT_EQUAL_HEX8(RX_MARKER_OVERRUN, serial.peek());
+  parser.update();
+
+  assert_position(4, 4, 4, 4, 4, 4);
+  TEST_ASSERT_EQUAL(overruns + 1, serial.get_overruns());
+  TEST_ASSERT_EQUAL(1, parser.get_link_stats().overruns);
+  TEST_ASSERT_EQUAL(1, parser.get_link_stats().frames_lost);
+}
+
+void test_incomplete_next_message_keeps_current_one()
+{
+  const std::string next = position_message(2, 2, 2, 2, 2, 2);
+  receive(serial, position_message(7, 7, 7, 7, 7, 7));
+  receive(serial, next.substr(0, 10));
+  parser.update();
+
+  assert_position(7, 7, 7, 7, 7, 7);
+  TEST_ASSERT_EQUAL(0, parser.get_merged_frames());
+
+  // the rest arrives with the next update
+  receive(serial, next.substr(10));
+  parser.update();
+  assert_position(2, 2, 2, 2, 2, 2);
+}
+
+void test_keypress_between_position_messages()
+{
+  receive(serial, position_message(1, 1, 1, 1, 1, 1));
+  receive(serial, keypress_message(0x005));
+  receive(serial, position_message(3, 3, 3, 3, 3, 3));
+  parser.update();
+
+  assert_position(3, 3, 3, 3, 3, 3);
+  TEST_ASSERT_EQUAL_HEX16(0x005, parser.get_buttons());
+  TEST_ASSERT_EQUAL(1, parser.get_merged_frames());
+}
+
+void test_beep_echo_is_a_known_message()
+{
+  // beep() sends two beeps, the space mouse echoes both
+  receive(serial, "b\r");
+  receive(serial, position_message(5, 5, 5, 5, 5, 5));
+  receive(serial, "b\r");
+  parser.update();
+
+  assert_position(5, 5, 5, 5, 5, 5);
+  TEST_ASSERT_EQUAL(0, parser.get_link_stats().resyncs);
+  TEST_ASSERT_EQUAL(0, parser.get_link_stats().bytes_discarded);
+  TEST_ASSERT_EQUAL(0, parser.get_link_stats().frames_lost);
+}
+
+void test_error_message_is_counted()
+{
+  receive(serial, "e\r");
+  receive(serial, "e??\r");
+  parser.update();
+
+  TEST_ASSERT_EQUAL(2, parser.get_link_stats().device_errors);
+  TEST_ASSERT_EQUAL(0, parser.get_link_stats().resyncs);
+  TEST_ASSERT_EQUAL(0, parser.get_link_stats().bytes_discarded);
+}
+
+void test_update_reports_only_changed_groups()
+{
+  receive(serial, position_message(0, 0, 0, 5, 0, 0));
+  TEST_ASSERT_EQUAL_HEX8(CHANGED_ROTATION, parser.update());
+
+  receive(serial, position_message(0, 7, 0, 5, 0, 0));
+  TEST_ASSERT_EQUAL_HEX8(CHANGED_TRANSLATION, parser.update());
+
+  receive(serial, keypress_message(0x010));
+  TEST_ASSERT_EQUAL_HEX8(CHANGED_BUTTONS, parser.update());
+
+  receive(serial, "qAB\r");
+  TEST_ASSERT_EQUAL_HEX8(CHANGED_SENSITIVITY, parser.update());
+
+  receive(serial, "mA\r");
+  TEST_ASSERT_EQUAL_HEX8(CHANGED_MODE, parser.update());
+
+  // nothing received, nothing changed
+  TEST_ASSERT_EQUAL_HEX8(CHANGED_NONE, parser.update());
+}
+
+void test_repeated_identical_messages_report_no_change()
+{
+  receive(serial, position_message(10, -20, 30, -40, 50, -60));
+  receive(serial, keypress_message(0x003));
+  TEST_ASSERT_EQUAL_HEX8(CHANGED_TRANSLATION | CHANGED_ROTATION | CHANGED_BUTTONS, parser.update());
+
+  for (uint8_t i = 0; i < 5; i++)
+  {
+    receive(serial, position_message(10, -20, 30, -40, 50, -60));
+    receive(serial, keypress_message(0x003));
+    receive(serial, "qAB\r");
+    receive(serial, "qAB\r");
+    TEST_ASSERT_EQUAL_HEX8(i == 0 ? CHANGED_SENSITIVITY : CHANGED_NONE, parser.update());
+  }
+}
+
+void test_value_changed_back_within_one_update_reports_no_change()
+{
+  receive(serial, position_message(1, 1, 1, 1, 1, 1));
+  parser.update();
+
+  // merged within one update(), the newest message equals the values before the call
+  receive(serial, position_message(2, 2, 2, 2, 2, 2));
+  receive(serial, position_message(1, 1, 1, 1, 1, 1));
+  TEST_ASSERT_EQUAL_HEX8(CHANGED_NONE, parser.update());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_single_position_message_is_applied);
+  RUN_TEST(test_queued_position_messages_are_merged);
+  RUN_TEST(test_corrupt_next_message_keeps_current_one);
+  RUN_TEST(test_line_error_in_next_message_keeps_current_one);
+  RUN_TEST(test_overrun_in_next_message_keeps_current_one);
+  RUN_TEST(test_overrun_is_marked_before_the_byte);
+  RUN_TEST(test_full_ring_buffer_is_an_overrun);
+  RUN_TEST(test_incomplete_next_message_keeps_current_one);
+  RUN_TEST(test_keypress_between_position_messages);
+  RUN_TEST(test_beep_echo_is_a_known_message);
+  RUN_TEST(test_error_message_is_counted);
+  RUN_TEST(test_update_reports_only_changed_groups);
+  RUN_TEST(test_repeated_identical_messages_report_no_change);
+  RUN_TEST(test_value_changed_back_within_one_update_reports_no_change);
+  return UNITY_END();
+}